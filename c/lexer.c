@@ -4,6 +4,30 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 typedef enum
 {
@@ -16,40 +40,97 @@ typedef enum
 
 #define BUFSIZE 8192
 
+// reads either from a memory mapped file, where the whole input is in buf, or streams through a growable buffer
 typedef struct
 {
   FILE *file;
-  char buf[BUFSIZE], *lim, *cur, *tok;
+  char *buf, *lim, *cur, *tok;
+  size_t cap;
   token_type state;
   bool eof;
+  // words can point into a mapped buffer as it is never unmapped or overwritten
+  bool mapped;
+  // words are copied even from a mapped buffer as it is unmapped by close_lexer
+  bool copy_words;
 } FileLexerState;
 
-FileLexerState init_lexer(FILE *file)
+void init_lexer(FileLexerState *st, FILE *file)
 {
-  FileLexerState st;
-  st.file = file;
-  st.cur = st.tok = st.buf;
-  const size_t read = fread(st.buf, 1, BUFSIZE, file);
-  st.lim = st.buf + read;
-  st.eof = read < BUFSIZE;
-  st.state = UNSET;
-  return st;
+  st->file = file;
+  st->cap = BUFSIZE;
+  st->buf = malloc(st->cap);
+  st->cur = st->tok = st->buf;
+  const size_t read = fread(st->buf, 1, st->cap, file);
+  st->lim = st->buf + read;
+  st->eof = read < st->cap;
+  st->state = UNSET;
+  st->mapped = false;
+  st->copy_words = false;
+}
+
+// maps a regular file, returns false if it cannot be mapped and should be streamed
+// lexes size bytes at data, which must outlive all parsed words
+void init_memory_lexer(FileLexerState *st, char *data, size_t size)
+{
+  st->file = NULL;
+  st->cap = size;
+  st->buf = st->cur = st->tok = data;
+  st->lim = data + size;
+  st->eof = true;
+  st->state = UNSET;
+  st->mapped = true;
+  st->copy_words = false;
+}
+
+bool init_mapped_lexer(FileLexerState *st, FILE *file)
+{
+  const int fd = fileno(file);
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+    return false;
+  char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return false;
+  madvise(data, sb.st_size, MADV_SEQUENTIAL);
+  init_memory_lexer(st, data, sb.st_size);
+  st->file = file;
+  return true;
+}
+
+// frees the stream buffer or unmaps the file, memory given to init_memory_lexer belongs to the caller
+void close_lexer(FileLexerState *st)
+{
+  if (!st->mapped)
+    free(st->buf);
+  else if (st->file != NULL)
+    munmap(st->buf, st->lim - st->buf);
 }
 
 void fill(FileLexerState *st)
 {
   const ssize_t shift = st->tok - st->buf;
   const ssize_t used = st->lim - st->tok;
-  const ssize_t free = BUFSIZE - used;
 
-  assert(shift >= 1 && "fill: could not fill lexeme longer than buffer");
-
-  memmove(st->buf, st->tok, used);
-  st->lim -= shift;
-  st->cur -= shift;
-  st->tok -= shift;
+  if (shift == 0)
+  {
+    // the current lexeme fills the whole buffer, grow it
+    const ssize_t cur = st->cur - st->buf;
+    st->cap *= 2;
+    st->buf = realloc(st->buf, st->cap);
+    st->lim = st->buf + used;
+    st->cur = st->buf + cur;
+    st->tok = st->buf;
+  }
+  else
+  {
+    memmove(st->buf, st->tok, used);
+    st->lim -= shift;
+    st->cur -= shift;
+    st->tok -= shift;
+  }
 
   // Fill free space at the end of buffer with new data.
+  const ssize_t free = st->cap - used;
   const size_t read = fread(st->lim, 1, free, st->file);
   st->eof = read < (size_t)free;
   st->lim += read;
@@ -61,7 +142,8 @@ int peek_char(FileLexerState *st)
     fill(st);
   if (st->lim <= st->cur)
     return -1;
-  const char c = *st->cur;
+  // unsigned so bytes above 0x7f are not taken for the end of input, classify_char rejects them
+  const unsigned char c = *st->cur;
   assert(c != 0 && "peek_char: cur == 0");
   return c;
 }
@@ -74,6 +156,8 @@ void next_char(FileLexerState *st)
   st->cur++;
 }
 
+void flush_output();
+
 token_type classify_char(char c)
 {
   switch (c)
@@ -91,369 +175,1388 @@ token_type classify_char(char c)
   case '=':
     return WORD;
   default:
+    flush_output();
     printf("classify_char: bad char\n");
     exit(1);
   }
 }
 
-typedef enum
+bool is_whitespace_char(char c)
 {
-  form_word = 1,
-  form_list = 2,
-} form_tag;
+  return c == ' ' || c == '\n';
+}
 
-typedef struct form
+bool is_word_char(char c)
 {
-  form_tag tag;
-  ssize_t len;
-  union
-  {
-    // add length to word
-    char *word;
-    struct form *forms;
-  };
-} form_t;
+  return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '=';
+}
 
-form_t parse(FileLexerState *st)
+// runs of whitespace and word chars are scanned a vector at a time, the byte ending a run is left to classify_char which rejects illegal bytes
+#if defined(__AVX2__)
+#define SCAN_WIDTH 32
+#define SCAN_ALL ((uint32_t)0xffffffff)
+typedef __m256i scan_vec_t;
+#define scan_load(p) _mm256_loadu_si256((const scan_vec_t *)(p))
+#define scan_set1(c) _mm256_set1_epi8(c)
+#define scan_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define scan_or(a, b) _mm256_or_si256(a, b)
+#define scan_sub(a, b) _mm256_sub_epi8(a, b)
+#define scan_min(a, b) _mm256_min_epu8(a, b)
+#define scan_movemask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#define SCAN_WIDTH 16
+#define SCAN_ALL ((uint32_t)0xffff)
+typedef __m128i scan_vec_t;
+#define scan_load(p) _mm_loadu_si128((const scan_vec_t *)(p))
+#define scan_set1(c) _mm_set1_epi8(c)
+#define scan_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define scan_or(a, b) _mm_or_si128(a, b)
+#define scan_sub(a, b) _mm_sub_epi8(a, b)
+#define scan_min(a, b) _mm_min_epu8(a, b)
+#define scan_movemask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#ifdef SCAN_WIDTH
+// bytes in [lo, lo + n] as an unsigned range check
+#define scan_in_range(v, lo, n) scan_eq(scan_min(scan_sub(v, scan_set1(lo)), scan_set1(n)), scan_sub(v, scan_set1(lo)))
+
+uint32_t whitespace_mask(const char *p)
 {
-  char c;
-next:
-  c = peek_char(st);
-  if (c < 0)
-  {
-    printf("parse Error: unexpected EOF\n");
-    exit(1);
-  }
-  switch (classify_char(c))
-  {
-  case WHITESPACE:
-    next_char(st);
-    goto next;
-  case WORD:
-  {
-    st->tok = st->cur;
-    do
-    {
-      next_char(st);
-    } while (classify_char(peek_char(st)) == WORD);
-    const int len = st->cur - st->tok;
-    char *word = malloc(len + 1);
-    memcpy(word, st->tok, len);
-    word[len] = '\0';
-    return (form_t){.tag = form_word, .len = len, .word = word};
-  }
-  case START_LIST:
-  {
-    next_char(st);
-    form_t *forms = NULL;
-    int len = 0;
-    while (1)
-    {
-      c = peek_char(st);
-      if (c < 0)
-      {
-        printf("parse Error: unexpected EOF\n");
-        exit(1);
-      }
-      const token_type class = classify_char(c);
-      if (class == END_LIST)
-      {
-        next_char(st);
-        break;
-      }
-      if (class == WHITESPACE)
-      {
-        next_char(st);
-        continue;
-      }
-      forms = realloc(forms, sizeof(form_t) * (len + 1));
-      forms[len++] = parse(st);
-    }
-    return (form_t){.tag = form_list, .len = len, .forms = forms};
-  }
+  const scan_vec_t v = scan_load(p);
+  return scan_movemask(scan_or(scan_eq(v, scan_set1(' ')), scan_eq(v, scan_set1('\n'))));
+}
 
-  default:
-    printf("parse Error: unexpected token\n");
-    exit(1);
-    break;
-  }
+uint32_t word_mask(const char *p)
+{
+  const scan_vec_t v = scan_load(p);
+  const scan_vec_t letters = scan_in_range(v, 'a', 'z' - 'a');
+  const scan_vec_t digits = scan_in_range(v, '0', '9' - '0');
+  const scan_vec_t punct = scan_or(scan_eq(v, scan_set1('-')), scan_or(scan_eq(v, scan_set1('.')), scan_eq(v, scan_set1('='))));
+  return scan_movemask(scan_or(scan_or(letters, digits), punct));
 }
+#endif
 
-void print_form(form_t form)
+// returns the first byte in [p, lim) not of class, which is WHITESPACE or WORD
+const char *scan_run(const char *p, const char *lim, token_type class)
 {
-  switch (form.tag)
+#ifdef SCAN_WIDTH
+  while (lim - p >= SCAN_WIDTH)
   {
-  case form_word:
-    printf("%s", form.word);
-    break;
-  case form_list:
-    if (form.len == 0)
-    {
-      printf("[]");
-      return;
-    }
-    printf("[");
-    print_form(form.forms[0]);
-
-    for (int i = 1; i < form.len; i++)
-    {
-      printf(" ");
-      print_form(form.forms[i]);
-    }
-    printf("]");
-    break;
-  default:
-    printf("print_form Error: unknown tag %d\n", form.tag);
-    exit(1);
+    const uint32_t mask = class == WHITESPACE ? whitespace_mask(p) : word_mask(p);
+    if (mask != SCAN_ALL)
+      return p + __builtin_ctz(~mask);
+    p += SCAN_WIDTH;
   }
+#endif
+  if (class == WHITESPACE)
+    while (p < lim && is_whitespace_char(*p))
+      p++;
+  else
+    while (p < lim && is_word_char(*p))
+      p++;
+  return p;
 }
 
-const form_t unit = {.tag = form_list, .len = 0, .forms = NULL};
-
-const form_t zero = {.tag = form_word, .len = 1, .word = "0"};
-const form_t one = {.tag = form_word, .len = 1, .word = "1"};
-const form_t two = {.tag = form_word, .len = 1, .word = "2"};
-
-form_t word_from_int(int n)
+// advances cur past a run of class, refilling the buffer as needed, tok is kept in the buffer
+void skip_run(FileLexerState *st, token_type class)
 {
-  switch (n)
+  while (1)
   {
-  case 0:
-    return zero;
-  case 1:
-    return one;
-  case 2:
-    return two;
+    st->cur = (char *)scan_run(st->cur, st->lim, class);
+    if (st->cur < st->lim || st->eof)
+      return;
+    // whitespace need not be kept
+    if (class == WHITESPACE)
+      st->tok = st->cur;
+    fill(st);
   }
-  char *result = malloc(12);
-  sprintf(result, "%d", n);
-  return (form_t){.tag = form_word, .len = strlen(result), .word = result};
 }
 
-const form_t continueSpecialWord = {.tag = form_word, .len = 0, .word = "*continue*"};
-
-void assert_word_or_list(form_t a)
+// all words are interned so that two equal words share the same pointer
+typedef struct
 {
-  assert(a.tag == form_word || a.tag == form_list && "tag must be word or list");
-}
+  const char *name;
+  size_t len;
+  size_t hash;
+} symbol_entry_t;
 
-bool is_word(form_t a)
+typedef struct
 {
-  assert_word_or_list(a);
-  return a.tag == form_word;
-}
+  size_t cap;
+  size_t len;
+  symbol_entry_t *entries;
+} symbol_table_t;
 
-bool is_list(form_t a)
+symbol_table_t symbol_table = {.cap = 0, .len = 0, .entries = NULL};
+
+// the table is shared by all interpreters, it is locked once more than one thread uses it
+pthread_mutex_t symbol_table_lock = PTHREAD_MUTEX_INITIALIZER;
+bool symbol_table_shared = false;
+
+size_t hash_bytes(const char *s, size_t len)
 {
-  assert_word_or_list(a);
-  return a.tag == form_list;
+  // fnv-1a
+  size_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ull;
+  }
+  return h;
 }
 
-int word_to_int(form_t a)
+void symbol_table_grow()
 {
-  char *endptr;
-  long int a_val = strtol(a.word, &endptr, 10);
-  assert(*endptr == '\0' && "word_to_int requires a decimal word");
-  assert(a_val <= INT_MAX && a_val >= INT_MIN && "word_to_int overflow");
-  return a_val;
+  const size_t old_cap = symbol_table.cap;
+  symbol_entry_t *old_entries = symbol_table.entries;
+  symbol_table.cap = old_cap == 0 ? 1024 : old_cap * 2;
+  symbol_table.entries = calloc(symbol_table.cap, sizeof(symbol_entry_t));
+  const size_t mask = symbol_table.cap - 1;
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    const symbol_entry_t e = old_entries[i];
+    if (e.name == NULL)
+      continue;
+    size_t j = e.hash & mask;
+    while (symbol_table.entries[j].name != NULL)
+      j = (j + 1) & mask;
+    symbol_table.entries[j] = e;
+  }
+  free(old_entries);
 }
 
-#define BUILTIN_TWO_DECIMAL_OP(name, op)            \
-  form_t name(form_t a, form_t b)                   \
-  {                                                 \
-    const int r = word_to_int(a) op word_to_int(b); \
-    return word_from_int(r);                        \
+const char *symbol_table_insert(const char *s, size_t len, const char *storage)
+{
+  if ((symbol_table.len + 1) * 2 > symbol_table.cap)
+    symbol_table_grow();
+  const size_t hash = hash_bytes(s, len);
+  const size_t mask = symbol_table.cap - 1;
+  size_t i = hash & mask;
+  while (symbol_table.entries[i].name != NULL)
+  {
+    const symbol_entry_t *e = &symbol_table.entries[i];
+    if (e->hash == hash && e->len == len && memcmp(e->name, s, len) == 0)
+      return e->name;
+    i = (i + 1) & mask;
   }
+  if (storage == NULL)
+  {
+    char *copy = malloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    storage = copy;
+  }
+  symbol_table.entries[i] = (symbol_entry_t){.name = storage, .len = len, .hash = hash};
+  symbol_table.len++;
+  return storage;
+}
 
-BUILTIN_TWO_DECIMAL_OP(bi_add, +)
-BUILTIN_TWO_DECIMAL_OP(bi_sub, -)
-BUILTIN_TWO_DECIMAL_OP(bi_bit_and, &)
-BUILTIN_TWO_DECIMAL_OP(bi_bit_or, |)
-BUILTIN_TWO_DECIMAL_OP(bi_bit_xor, ^)
-BUILTIN_TWO_DECIMAL_OP(bi_bit_shift_left, <<)
-BUILTIN_TWO_DECIMAL_OP(bi_bit_shift_right_unsigned, >>)
-
-int bit_shift_right_signed(int v, int shift)
+// returns the canonical pointer for the word s of length len
+// if the word is new and storage is not NULL, storage becomes the canonical pointer, otherwise a copy is made
+const char *intern_with_storage(const char *s, size_t len, const char *storage)
 {
-  int result = v >> shift;
-  if (v >= 0)
-    return result;
-  return (result | (~0 << (sizeof(int) * CHAR_BIT - shift)));
+  if (!symbol_table_shared)
+    return symbol_table_insert(s, len, storage);
+  pthread_mutex_lock(&symbol_table_lock);
+  const char *name = symbol_table_insert(s, len, storage);
+  pthread_mutex_unlock(&symbol_table_lock);
+  return name;
 }
 
-form_t bi_bit_shift_right_signed(form_t a, form_t b)
+const char *intern(const char *s, size_t len)
 {
-  return word_from_int(bit_shift_right_signed(word_to_int(a), word_to_int(b)));
+  return intern_with_storage(s, len, NULL);
 }
 
-form_t bi_eq(form_t a, form_t b)
+// length of an interned word, words are not nul terminated so this scans the table, only use it for messages
+int symbol_length(const char *name)
 {
-  assert(is_word(a) && is_word(b) && "eq requires words");
-  return a.len == b.len && memcmp(a.word, b.word, a.len) == 0 ? one : zero;
+  if (symbol_table_shared)
+    pthread_mutex_lock(&symbol_table_lock);
+  int len = 0;
+  for (size_t i = 0; i < symbol_table.cap; i++)
+    if (symbol_table.entries[i].name == name)
+    {
+      len = symbol_table.entries[i].len;
+      break;
+    }
+  if (symbol_table_shared)
+    pthread_mutex_unlock(&symbol_table_lock);
+  return len;
 }
 
-#define BUILTIN_TWO_DECIMAL_CMP(name, op)                 \
-  form_t name(form_t a, form_t b)                         \
-  {                                                       \
-    return word_to_int(a) op word_to_int(b) ? one : zero; \
-  }
-
-BUILTIN_TWO_DECIMAL_CMP(bi_lt, <)
-BUILTIN_TWO_DECIMAL_CMP(bi_le, <=)
-BUILTIN_TWO_DECIMAL_CMP(bi_ge, >=)
-BUILTIN_TWO_DECIMAL_CMP(bi_gt, >)
+typedef enum
+{
+  form_word = 1,
+  form_list = 2,
+  // a decimal word stored as an int32, its text is only materialized when needed
+  form_int = 3,
+  // returned by cont to its loop after it stored the new values in the loop frame, never a value
+  form_continue = 4,
+} form_tag;
 
-form_t bi_is_word(form_t a)
+typedef struct form
 {
-  return is_word(a) ? one : zero;
-}
+  form_tag tag;
+  // a list is a view of len forms starting at off in its backing array, backing arrays are never mutated so views share them
+  uint32_t off;
+  ssize_t len;
+  union
+  {
+    // add length to word
+    const char *word;
+    struct form *forms;
+    int number;
+  };
+} form_t;
 
-form_t bi_is_list(form_t a)
+// the elements of a list
+const form_t *form_items(form_t form)
 {
-  return is_list(a) ? one : zero;
+  return form.forms + form.off;
 }
 
-form_t bi_size(form_t a)
+// the decimal text of 0 to 99, two chars each
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// the number of decimal digits of u, from its bit length without a loop, 0 has one like 1
+int decimal_digits(unsigned int u)
 {
-  return word_from_int(a.len);
+  static const unsigned int powers_of_10[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+  const int guess = (32 - __builtin_clz(u | 1)) * 1233 >> 12;
+  return guess + 1 - ((u | 1) < powers_of_10[guess]);
 }
 
-form_t bi_word_from_codepoints(form_t a)
+// writes the decimal text of n to buf, returns its length
+// digits are written two at a time from the end, the sign is written first and overwritten by a digit when n is not negative
+int int_to_chars(int n, char buf[12])
 {
-  assert(is_list(a) && "word_from_codepoints requires a list");
-  const int len = a.len;
-  char *word = malloc(len + 1);
-  for (int i = 0; i < len; i++)
+  unsigned int u = n < 0 ? -(unsigned int)n : (unsigned int)n;
+  const int len = (n < 0) + decimal_digits(u);
+  char *p = buf + len;
+  buf[0] = '-';
+  while (u >= 100)
   {
-    form_t codepoint = a.forms[i];
-    int cp = word_to_int(codepoint);
-    assert(classify_char(cp) == WORD && "word_from_codepoints requires a list of decimal words corresponding to ascii codes for word characters");
-    word[i] = cp;
+    const unsigned int q = u / 100;
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * (u - q * 100), 2);
+    u = q;
+  }
+  if (u >= 10)
+  {
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * u, 2);
   }
-  word[len] = '\0';
-  return (form_t){.tag = form_word, .len = len, .word = word};
+  else
+    *--p = '0' + u;
+  return len;
 }
 
-form_t bi_log(form_t a)
+// region allocator, objects are bump allocated and released together when the region is reset
+typedef struct arena_block
 {
-  printf("wuns: ");
-  print_form(a);
-  printf("\n");
-  return unit;
-}
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[];
+} arena_block_t;
 
-form_t bi_abort()
+typedef struct
 {
-  puts("wuns abort");
-  exit(1);
-}
+  arena_block_t *head;
+  // blocks kept from the last reset, reused before allocating new ones
+  arena_block_t *free_blocks;
+} arena_t;
 
-form_t bi_at(form_t a, form_t b)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+// bytes of blocks kept on reset, the rest is returned to the system
+#define ARENA_RETAIN_SIZE (4 * 1024 * 1024)
+
+// the collected heap, see gc_alloc_backing
+typedef struct
 {
-  int index = word_to_int(b);
-  assert(index >= -a.len && index < a.len && "at index out of bounds");
-  if (index < 0)
-    index += a.len;
-  if (is_list(a))
-    return a.forms[index];
-  assert(is_word(a) && "at requires a list or a word");
-  return word_from_int(a.word[index]);
-}
+  struct gc_object *objects;
+  // bytes of all objects, live or not
+  size_t bytes;
+  // collect when bytes reaches it
+  size_t threshold;
+  size_t collections;
+  uint64_t total_pause_ns;
+  uint64_t max_pause_ns;
+  size_t live_bytes;
+  size_t peak_bytes;
+  size_t freed_objects;
+  size_t released_objects;
+} gc_heap_t;
 
-form_t slice(int len, const form_t *forms, int start, int end)
+// ranges of forms reachable from the native stack of eval
+typedef struct
 {
-  // do it like in js https://developer.mozilla.org/en-US/docs/Web/JavaScript/Reference/Global_Objects/Array/slice
-  // as ousterhout says as well don't throw errors, just return empty list
-  if (start >= len)
-    return unit;
-  if (start < -len)
-    start = 0;
-  else if (start < 0)
-    start = len + start;
+  const form_t *forms;
+  size_t n;
+} gc_root_range_t;
 
-  if (end == 0 || end < -len)
-    return unit;
-  if (end > len)
-    end = len;
-  else if (end < 0)
-    end = len + end;
+typedef struct
+{
+  size_t cap;
+  size_t len;
+  gc_root_range_t *ranges;
+} gc_roots_t;
 
-  const int length = end - start;
-  if (length <= 0)
-    return unit;
-  form_t *slice_forms = malloc(sizeof(form_t) * length);
-  for (int i = 0; i < length; i++)
-    slice_forms[i] = forms[start + i];
-  return (form_t){.tag = form_list, .len = length, .forms = slice_forms};
-}
+// values of the frames of eval for calls, lets and loops, pushed and popped in call order
+// a frame never spans two segments so the values an Env_t points to do not move when the stack grows
+typedef struct value_segment
+{
+  struct value_segment *below;
+  // kept when the stack shrinks, reused before allocating a new segment
+  struct value_segment *above;
+  size_t cap;
+  size_t used;
+  form_t values[];
+} value_segment_t;
 
-form_t bi_slice(form_t v, form_t i, form_t j)
+#define VALUE_SEGMENT_SIZE (16 * 1024)
+
+typedef struct
 {
-  assert(is_list(v) && "slice requires a list");
-  const int start = word_to_int(i);
-  const int end = word_to_int(j);
-  return slice(v.len, v.forms, start, end);
-}
+  size_t cap;
+  size_t len;
+  struct backing_header **headers;
+} gc_mark_stack_t;
 
-form_t bi_concat(size_t n, form_t *forms)
+// elements of the lists being parsed, the innermost open list owns the top of the stack
+typedef struct
 {
-  ssize_t total_length = 0;
-  for (size_t i = 0; i < n; i++)
-  {
-    assert(is_list(forms[i]) && "concat requires lists");
-    total_length += forms[i].len;
-  }
-  if (total_length == 0)
-    return unit;
-  form_t *concat_forms = malloc(sizeof(form_t) * total_length);
-  int k = 0;
-  for (size_t i = 0; i < n; i++)
-    for (int j = 0; j < forms[i].len; j++)
-      concat_forms[k++] = forms[i].forms[j];
-  return (form_t){.tag = form_list, .len = total_length, .forms = concat_forms};
-}
+  size_t cap;
+  size_t len;
+  form_t *forms;
+} parse_stack_t;
 
+// start of the elements of each open list in parse_stack, innermost last
 typedef struct
 {
-  const int parameters;
-  const bool variadic;
-  union
-  {
-    form_t (*func0)();
-    form_t (*func1)(form_t);
-    form_t (*func2)(form_t, form_t);
-    form_t (*func3)(form_t, form_t, form_t);
-    form_t (*funcvar)(size_t, form_t *);
-  };
-} built_in_func_t;
+  size_t cap;
+  size_t len;
+  size_t *bases;
+} open_lists_t;
 
-bool streq(const char *a, const char *b)
+// a list being printed and its next element
+typedef struct
 {
-  return strcmp(a, b) == 0;
-}
+  const form_t *forms;
+  ssize_t len;
+  ssize_t next;
+} print_frame_t;
 
-form_t bi_gensym()
+typedef struct
 {
-  static int counter = 0;
-  char *result = malloc(12);
-  sprintf(result, "gensym%d", counter++);
-  return (form_t){.tag = form_word, .len = strlen(result), .word = result};
-}
+  size_t cap;
+  print_frame_t *frames;
+} print_stack_t;
+
+// what is printed is gathered here and handed to out in large writes, straight to its descriptor when it has one
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
 
 typedef struct
 {
-  const char *name;
-  built_in_func_t func;
-} built_in_func_entry_t;
+  char *data;
+  size_t len;
+  // descriptor of out, -1 for memory streams
+  int fd;
+  // a terminal sees each result as soon as its top-level form is done
+  bool interactive;
+  // bytes handed to out so far
+  size_t written;
+} output_buffer_t;
 
-static const built_in_func_entry_t built_in_funcs[] = {
-    {"abort", {.parameters = 0, .func0 = bi_abort}},
-    {"gensym", {.parameters = 0, .func0 = bi_gensym}},
+typedef struct func_macro_binding FuncMacroBinding;
 
-    {"is-word", {.parameters = 1, .func1 = bi_is_word}},
-    {"is-list", {.parameters = 1, .func1 = bi_is_list}},
-    {"size", {.parameters = 1, .func1 = bi_size}},
-    {"log", {.parameters = 1, .func1 = bi_log}},
+// open addressing hash table keyed by interned name, bindings are never removed
+typedef struct
+{
+  int cap;
+  int len;
+  FuncMacroBinding *bindings;
+} FuncMacroEnv;
+
+// interned names to non-negative ints, open addressing like the func/macro env, also used as a set of names
+typedef struct
+{
+  int cap;
+  int len;
+  const char **names;
+  int *values;
+} name_map_t;
+
+// everything an interpreter mutates, the symbol table and the options are shared by all of them
+// each thread runs one interpreter at a time, the one interp points to
+typedef struct
+{
+  // long lived region for func/macro definitions
+  arena_t permanent_arena;
+  // short lived region for everything created while evaluating one top-level form
+  arena_t transient_arena;
+  // region nodes are compiled into, permanent while compiling func/macro bodies
+  arena_t *node_arena;
+  // totals over all arenas and the collected heap, read by the benchmark mode and the profiler
+  size_t arena_allocation_count;
+  size_t arena_allocated_bytes;
+  gc_heap_t gc;
+  gc_roots_t gc_roots;
+  // the segment frames are pushed to, its used values and those of the segments below are roots for the collector
+  value_segment_t *value_stack;
+  gc_mark_stack_t gc_mark_stack;
+  parse_stack_t parse_stack;
+  // number of forms parsed, nested ones included
+  size_t parsed_forms;
+  open_lists_t open_lists;
+  print_stack_t print_stack;
+  // where results and log go
+  FILE *out;
+  output_buffer_t output;
+  FuncMacroEnv func_macro_env;
+  // number of user definitions that shadow a builtin, builtin call nodes only look for them when non-zero
+  int shadowed_builtins;
+  // bumped when a user definition is replaced, a macro is defined or a builtin is shadowed
+  // macro expansions cached and bytecode compiled before then are stale
+  int definition_epoch;
+  // definition_epoch when a func was last found not compilable by the vm
+  int not_compilable_epoch;
+  // macro call sites expanded so far, and how many when a func was last found not compilable
+  // a func with macro calls eval has not reached yet is tried again once more of them are expanded
+  size_t call_site_expansions;
+  size_t not_compilable_expansions;
+  // calls resolved from the inline cache of their call site and calls that looked their name up
+  size_t call_cache_hits;
+  size_t call_cache_misses;
+  int gensym_counter;
+  int eval_depth;
+  const char *native_stack_base;
+  size_t native_stack_budget;
+  form_t *vm_registers;
+  size_t vm_registers_cap;
+  // registers below it belong to running frames and are roots for the collector
+  // it only shrinks when a call returns so registers that were out of range and may be stale are cleared by the frame that uses them again
+  size_t vm_registers_live;
+  struct vm_frame *vm_frames;
+  int vm_frames_cap;
+  // where program_error goes when the program is run by a batch worker, NULL to exit
+  jmp_buf *on_error;
+  // taken before the first definition while it is set, see checkpoint_definitions
+  struct definitions_checkpoint *checkpoint;
+  // names looked up and names defined while they are set, see --watch
+  name_map_t *recorded_lookups;
+  name_map_t *recorded_definitions;
+} interp_t;
+
+_Thread_local interp_t *interp = NULL;
+
+// hands what is buffered and then extra to out, with one writev when out has a descriptor
+void output_drain(const char *extra, size_t extra_len)
+{
+  output_buffer_t *output = &interp->output;
+  output->written += output->len + extra_len;
+  if (output->fd < 0)
+  {
+    fwrite(output->data, 1, output->len, interp->out);
+    fwrite(extra, 1, extra_len, interp->out);
+    output->len = 0;
+    return;
+  }
+  // what was printed to out through stdio comes first
+  fflush(interp->out);
+  struct iovec iov[2] = {{.iov_base = output->data, .iov_len = output->len}, {.iov_base = (char *)extra, .iov_len = extra_len}};
+  struct iovec *next = iov;
+  int n_iov = extra_len == 0 ? 1 : 2;
+  while (n_iov > 0)
+  {
+    ssize_t n = writev(output->fd, next, n_iov);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      // like stdio the output is dropped when out is gone
+      break;
+    }
+    while (n_iov > 0 && (size_t)n >= next->iov_len)
+    {
+      n -= next->iov_len;
+      next++;
+      n_iov--;
+    }
+    if (n_iov > 0)
+    {
+      next->iov_base = (char *)next->iov_base + n;
+      next->iov_len -= n;
+    }
+  }
+  output->len = 0;
+}
+
+void flush_output()
+{
+  if (interp != NULL && interp->output.len > 0)
+    output_drain(NULL, 0);
+}
+
+// a failed assert aborts without running the atexit handlers, what was printed before it is written first
+void flush_output_on_abort(int signal)
+{
+  flush_output();
+  struct sigaction action = {.sa_handler = SIG_DFL};
+  sigaction(signal, &action, NULL);
+  raise(signal);
+}
+
+// flushes output when the process exits or aborts
+void flush_output_at_exit()
+{
+  atexit(flush_output);
+  struct sigaction action = {.sa_handler = flush_output_on_abort};
+  sigaction(SIGABRT, &action, NULL);
+}
+
+// flushes what was printed so far and prints to out from now on
+void set_output(FILE *out)
+{
+  flush_output();
+  interp->out = out;
+  interp->output.fd = out == NULL ? -1 : fileno(out);
+  interp->output.interactive = interp->output.fd >= 0 && isatty(interp->output.fd);
+  if (interp->output.data == NULL)
+    interp->output.data = malloc(OUTPUT_BUFFER_SIZE);
+}
+
+void output_chars(const char *chars, size_t len)
+{
+  output_buffer_t *output = &interp->output;
+  if (len > OUTPUT_BUFFER_SIZE - output->len)
+  {
+    // too long to buffer, written together with what is buffered
+    output_drain(chars, len);
+    return;
+  }
+  memcpy(output->data + output->len, chars, len);
+  output->len += len;
+  // a terminal sees whole lines as they are printed, like line buffered stdout
+  if (output->interactive && memchr(chars, '\n', len) != NULL)
+    output_drain(NULL, 0);
+}
+
+void output_char(char c)
+{
+  if (interp->output.len == OUTPUT_BUFFER_SIZE)
+    output_drain(NULL, 0);
+  interp->output.data[interp->output.len++] = c;
+  if (c == '\n' && interp->output.interactive)
+    output_drain(NULL, 0);
+}
+
+void output_int(int n)
+{
+  char buf[12];
+  output_chars(buf, int_to_chars(n, buf));
+}
+
+// reports an error of the program being run and stops it
+_Noreturn void program_error(const char *format, ...)
+{
+  flush_output();
+  va_list args;
+  va_start(args, format);
+  vfprintf(interp->out, format, args);
+  va_end(args);
+  if (interp->on_error != NULL)
+    longjmp(*interp->on_error, 1);
+  exit(1);
+}
+
+// checks the program being run, a failed check stops only the current file or request in batch and serve mode
+#define program_assert(cond, message)           \
+  do                                            \
+  {                                             \
+    if (!(cond) && interp->on_error != NULL)    \
+      program_error("Error: %s\n", message);     \
+    assert((cond) && message);                  \
+  } while (0)
+
+arena_block_t *arena_new_block(arena_t *arena, size_t size)
+{
+  arena_block_t *block = NULL;
+  if (arena->free_blocks != NULL && arena->free_blocks->size >= size)
+  {
+    block = arena->free_blocks;
+    arena->free_blocks = block->next;
+  }
+  else
+  {
+    const size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(arena_block_t) + block_size);
+    if (block == NULL)
+    {
+      flush_output();
+      printf("Error: out of memory\n");
+      exit(1);
+    }
+    block->size = block_size;
+  }
+  block->used = 0;
+  block->next = arena->head;
+  arena->head = block;
+  return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+  size = (size + 15) & ~(size_t)15;
+  interp->arena_allocation_count++;
+  interp->arena_allocated_bytes += size;
+  arena_block_t *block = arena->head;
+  if (block == NULL || block->size - block->used < size)
+  {
+    arena_block_t *current = block;
+    block = arena_new_block(arena, size);
+    // big allocations get a block of their own behind the current one which keeps serving small ones
+    if (current != NULL && size > ARENA_BLOCK_SIZE / 4 && current->size - current->used >= ARENA_BLOCK_SIZE / 4)
+    {
+      arena->head = current;
+      block->next = current->next;
+      current->next = block;
+    }
+  }
+  void *result = block->data + block->used;
+  block->used += size;
+  return result;
+}
+
+void arena_reset(arena_t *arena)
+{
+  size_t retained = 0;
+  for (arena_block_t *b = arena->free_blocks; b != NULL; b = b->next)
+    retained += b->size;
+  arena_block_t *block = arena->head;
+  while (block != NULL)
+  {
+    arena_block_t *next = block->next;
+    if (retained + block->size <= ARENA_RETAIN_SIZE)
+    {
+      retained += block->size;
+      block->next = arena->free_blocks;
+      arena->free_blocks = block;
+    }
+    else
+      free(block);
+    block = next;
+  }
+  arena->head = NULL;
+}
+
+// a position in an arena, arena_rollback releases what was allocated after it
+typedef struct
+{
+  arena_block_t *head;
+  size_t used;
+  // big allocations are put right behind the head, blocks from head up to next were there when the mark was taken
+  arena_block_t *next;
+} arena_mark_t;
+
+arena_mark_t arena_mark(const arena_t *arena)
+{
+  const arena_block_t *head = arena->head;
+  return (arena_mark_t){.head = arena->head, .used = head == NULL ? 0 : head->used, .next = head == NULL ? NULL : head->next};
+}
+
+void arena_release_block(arena_t *arena, arena_block_t *block)
+{
+  if (block->size != ARENA_BLOCK_SIZE)
+  {
+    free(block);
+    return;
+  }
+  block->next = arena->free_blocks;
+  arena->free_blocks = block;
+}
+
+void arena_rollback(arena_t *arena, arena_mark_t mark)
+{
+  arena_block_t *block = arena->head;
+  while (block != mark.head)
+  {
+    arena_block_t *next = block->next;
+    arena_release_block(arena, block);
+    block = next;
+  }
+  if (mark.head != NULL)
+  {
+    for (block = mark.head->next; block != mark.next;)
+    {
+      arena_block_t *next = block->next;
+      arena_release_block(arena, block);
+      block = next;
+    }
+    mark.head->next = mark.next;
+    mark.head->used = mark.used;
+  }
+  arena->head = mark.head;
+}
+
+// in front of every backing array, a concat extending the view that ends at used may claim the forms up to cap in place
+typedef struct backing_header
+{
+  uint32_t cap;
+  uint32_t used;
+  // allocated on the collected heap rather than in an arena
+  uint32_t in_heap;
+  uint32_t marked;
+} backing_header_t;
+
+backing_header_t *backing_header(const form_t *forms)
+{
+  return (backing_header_t *)forms - 1;
+}
+
+// a backing array with room for cap forms of which n are used
+form_t *alloc_backing(arena_t *arena, size_t n, size_t cap)
+{
+  if (cap > UINT32_MAX)
+  {
+    flush_output();
+    printf("Error: list too long\n");
+    exit(1);
+  }
+  backing_header_t *header = arena_alloc(arena, sizeof(backing_header_t) + sizeof(form_t) * cap);
+  *header = (backing_header_t){.cap = cap, .used = n, .in_heap = 0, .marked = 0};
+  return (form_t *)(header + 1);
+}
+
+form_t *alloc_forms(arena_t *arena, size_t n)
+{
+  return n == 0 ? NULL : alloc_backing(arena, n, n);
+}
+
+// lists made while evaluating live on a mark-sweep collected heap
+// parsed source and definitions live in the arenas and never point into the heap, promote_form copies out of it
+// so the roots are the env frames of eval on the value stack, its temporaries pushed on gc_roots, and the live vm registers
+typedef struct gc_object
+{
+  struct gc_object *next;
+  size_t size;
+} gc_object_t;
+
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD (8 * 1024 * 1024)
+#endif
+
+void gc_push_roots(const form_t *forms, size_t n)
+{
+  if (interp->gc_roots.len == interp->gc_roots.cap)
+  {
+    interp->gc_roots.cap = interp->gc_roots.cap == 0 ? 256 : interp->gc_roots.cap * 2;
+    interp->gc_roots.ranges = realloc(interp->gc_roots.ranges, sizeof(gc_root_range_t) * interp->gc_roots.cap);
+  }
+  interp->gc_roots.ranges[interp->gc_roots.len++] = (gc_root_range_t){.forms = forms, .n = n};
+}
+
+void gc_pop_roots()
+{
+  interp->gc_roots.len--;
+}
+
+// a frame of n values on the value stack, only their tags are cleared as the collector ignores the rest of values not set yet
+form_t *value_stack_push(size_t n)
+{
+  value_segment_t *top = interp->value_stack;
+  if (top == NULL || top->used + n > top->cap)
+  {
+    if (top != NULL && top->above != NULL && top->above->cap >= n)
+      top = top->above;
+    else
+    {
+      const size_t cap = n > VALUE_SEGMENT_SIZE ? n : VALUE_SEGMENT_SIZE;
+      value_segment_t *segment = malloc(sizeof(value_segment_t) + sizeof(form_t) * cap);
+      if (segment == NULL)
+      {
+        flush_output();
+        printf("Error: out of memory for eval frames\n");
+        exit(1);
+      }
+      *segment = (value_segment_t){.below = top, .above = top == NULL ? NULL : top->above, .cap = cap, .used = 0};
+      if (segment->above != NULL)
+        segment->above->below = segment;
+      if (top != NULL)
+        top->above = segment;
+      top = segment;
+    }
+    interp->value_stack = top;
+  }
+  form_t *values = top->values + top->used;
+  top->used += n;
+  for (size_t i = 0; i < n; i++)
+    values[i].tag = 0;
+  return values;
+}
+
+// pops the frame of n values pushed last
+// only the bottom segment is ever empty at the top as a segment is left when its last frame is popped
+void value_stack_pop(size_t n)
+{
+  value_segment_t *top = interp->value_stack;
+  top->used -= n;
+  if (top->used == 0 && top->below != NULL)
+    interp->value_stack = top->below;
+}
+
+void gc_collect();
+
+// a backing array on the collected heap, the caller fills the n used forms before allocating again
+form_t *gc_alloc_backing(size_t n, size_t cap)
+{
+  if (cap > UINT32_MAX)
+  {
+    flush_output();
+    printf("Error: list too long\n");
+    exit(1);
+  }
+  if (interp->gc.bytes >= interp->gc.threshold)
+    gc_collect();
+  const size_t size = sizeof(gc_object_t) + sizeof(backing_header_t) + sizeof(form_t) * cap;
+  gc_object_t *object = malloc(size);
+  if (object == NULL)
+  {
+    flush_output();
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+  object->next = interp->gc.objects;
+  object->size = size;
+  interp->gc.objects = object;
+  interp->gc.bytes += size;
+  interp->arena_allocation_count++;
+  interp->arena_allocated_bytes += size;
+  if (interp->gc.bytes > interp->gc.peak_bytes)
+    interp->gc.peak_bytes = interp->gc.bytes;
+  backing_header_t *header = (backing_header_t *)(object + 1);
+  *header = (backing_header_t){.cap = cap, .used = n, .in_heap = 1, .marked = 0};
+  return (form_t *)(header + 1);
+}
+
+// frees the whole heap, nothing on it outlives the top-level form that made it
+void gc_release_all()
+{
+  gc_object_t *object = interp->gc.objects;
+  while (object != NULL)
+  {
+    gc_object_t *next = object->next;
+    free(object);
+    interp->gc.released_objects++;
+    object = next;
+  }
+  interp->gc.objects = NULL;
+  interp->gc.bytes = 0;
+}
+
+// copies a form and all its sublists into arena, words are interned and need no copying
+form_t promote_form(arena_t *arena, form_t form)
+{
+  if (form.tag != form_list || form.len == 0)
+    return form;
+  form_t *forms = alloc_forms(arena, form.len);
+  for (ssize_t i = 0; i < form.len; i++)
+    forms[i] = promote_form(arena, form_items(form)[i]);
+  return (form_t){.tag = form_list, .len = form.len, .forms = forms};
+}
+
+void parse_stack_push(form_t form)
+{
+  if (interp->parse_stack.len == interp->parse_stack.cap)
+  {
+    interp->parse_stack.cap = interp->parse_stack.cap == 0 ? 256 : interp->parse_stack.cap * 2;
+    interp->parse_stack.forms = realloc(interp->parse_stack.forms, sizeof(form_t) * interp->parse_stack.cap);
+  }
+  interp->parse_stack.forms[interp->parse_stack.len++] = form;
+}
+
+// parses one form without recursing so nesting depth is only limited by memory
+form_t parse(FileLexerState *st)
+{
+  const size_t outer = interp->open_lists.len;
+  while (1)
+  {
+    st->tok = st->cur;
+    const int c = peek_char(st);
+    if (c < 0)
+      program_error("parse Error: unexpected EOF\n");
+    form_t form;
+    switch (classify_char(c))
+    {
+    case WHITESPACE:
+      skip_run(st, WHITESPACE);
+      continue;
+    case WORD:
+    {
+      interp->parsed_forms++;
+      skip_run(st, WORD);
+      const int len = st->cur - st->tok;
+      const char *word = intern_with_storage(st->tok, len, st->mapped && !st->copy_words ? st->tok : NULL);
+      form = (form_t){.tag = form_word, .len = len, .word = word};
+      break;
+    }
+    case START_LIST:
+      interp->parsed_forms++;
+      next_char(st);
+      if (interp->open_lists.len == interp->open_lists.cap)
+      {
+        interp->open_lists.cap = interp->open_lists.cap == 0 ? 64 : interp->open_lists.cap * 2;
+        interp->open_lists.bases = realloc(interp->open_lists.bases, sizeof(size_t) * interp->open_lists.cap);
+      }
+      interp->open_lists.bases[interp->open_lists.len++] = interp->parse_stack.len;
+      continue;
+    case END_LIST:
+    {
+      if (interp->open_lists.len == outer)
+        program_error("parse Error: unexpected token\n");
+      next_char(st);
+      // one exact size allocation per list, the stack is reused by the next list
+      const size_t base = interp->open_lists.bases[--interp->open_lists.len];
+      const size_t len = interp->parse_stack.len - base;
+      form_t *list_forms = alloc_forms(&interp->transient_arena, len);
+      if (len > 0)
+        memcpy(list_forms, interp->parse_stack.forms + base, sizeof(form_t) * len);
+      interp->parse_stack.len = base;
+      form = (form_t){.tag = form_list, .len = len, .forms = list_forms};
+      break;
+    }
+    default:
+      program_error("parse Error: unexpected token\n");
+    }
+    if (interp->open_lists.len == outer)
+      return form;
+    parse_stack_push(form);
+  }
+}
+
+void print_atom(form_t form)
+{
+  switch (form.tag)
+  {
+  case form_word:
+    output_chars(form.word, form.len);
+    break;
+  case form_int:
+    output_int(form.number);
+    break;
+  default:
+    flush_output();
+    printf("print_form Error: unknown tag %d\n", form.tag);
+    exit(1);
+  }
+}
+
+// prints without recursing so deeply nested data does not overflow the native stack
+void print_form(form_t form)
+{
+  size_t depth = 0;
+  while (1)
+  {
+    if (form.tag != form_list)
+      print_atom(form);
+    else if (form.len == 0)
+      output_chars("[]", 2);
+    else
+    {
+      output_char('[');
+      if (depth == interp->print_stack.cap)
+      {
+        interp->print_stack.cap = interp->print_stack.cap == 0 ? 64 : interp->print_stack.cap * 2;
+        interp->print_stack.frames = realloc(interp->print_stack.frames, sizeof(print_frame_t) * interp->print_stack.cap);
+      }
+      interp->print_stack.frames[depth++] = (print_frame_t){.forms = form_items(form), .len = form.len, .next = 1};
+      form = form_items(form)[0];
+      continue;
+    }
+    while (depth > 0 && interp->print_stack.frames[depth - 1].next == interp->print_stack.frames[depth - 1].len)
+    {
+      output_char(']');
+      depth--;
+    }
+    if (depth == 0)
+      return;
+    output_char(' ');
+    print_frame_t *frame = &interp->print_stack.frames[depth - 1];
+    form = frame->forms[frame->next++];
+  }
+}
+
+const form_t unit = {.tag = form_list, .len = 0, .forms = NULL};
+
+const form_t zero = {.tag = form_int, .number = 0};
+const form_t one = {.tag = form_int, .number = 1};
+
+form_t word_from_int(int n)
+{
+  return (form_t){.tag = form_int, .number = n};
+}
+
+// the interned word with the text of an int form
+const char *int_symbol(form_t a)
+{
+  char buf[12];
+  return intern(buf, int_to_chars(a.number, buf));
+}
+
+// if word is the canonical decimal text of an int32, i.e. what int_to_chars would produce, stores it in result
+bool word_is_canonical_int(const char *word, ssize_t len, int *result)
+{
+  const bool negative = len > 0 && word[0] == '-';
+  const ssize_t start = negative ? 1 : 0;
+  const ssize_t digits = len - start;
+  if (digits < 1 || digits > 10 || (word[start] == '0' && (digits > 1 || negative)))
+    return false;
+  long long value = 0;
+  for (ssize_t i = start; i < len; i++)
+  {
+    if (word[i] < '0' || word[i] > '9')
+      return false;
+    value = value * 10 + (word[i] - '0');
+  }
+  if (negative)
+    value = -value;
+  if (value < INT_MIN || value > INT_MAX)
+    return false;
+  *result = value;
+  return true;
+}
+
+const form_t continue_signal = {.tag = form_continue, .len = 0, .forms = NULL};
+
+// interned special words, set by init_symbols
+const char *sym_zero, *sym_quote, *sym_if, *sym_let, *sym_loop, *sym_cont, *sym_func, *sym_macro, *sym_rest;
+
+void init_vm_op_symbols();
+
+void init_symbols()
+{
+  sym_zero = intern("0", 1);
+  sym_quote = intern("quote", 5);
+  sym_if = intern("if", 2);
+  sym_let = intern("let", 3);
+  sym_loop = intern("loop", 4);
+  sym_cont = intern("cont", 4);
+  sym_func = intern("func", 4);
+  sym_macro = intern("macro", 5);
+  sym_rest = intern("..", 2);
+  init_vm_op_symbols();
+}
+
+void assert_word_or_list(form_t a)
+{
+  program_assert(a.tag == form_word || a.tag == form_int || a.tag == form_list, "tag must be word or list");
+}
+
+bool is_word(form_t a)
+{
+  assert_word_or_list(a);
+  return a.tag == form_word || a.tag == form_int;
+}
+
+// the interned word of a word form
+const char *word_symbol(form_t a)
+{
+  return a.tag == form_int ? int_symbol(a) : a.word;
+}
+
+// 0 is the only false value, as a word or an int
+bool is_false(form_t a)
+{
+  return a.tag == form_int ? a.number == 0 : a.tag == form_word && a.word == sym_zero;
+}
+
+// text of a word form, ints are written to buf
+const char *word_chars(form_t a, char buf[12], ssize_t *len)
+{
+  if (a.tag == form_int)
+  {
+    *len = int_to_chars(a.number, buf);
+    return buf;
+  }
+  *len = a.len;
+  return a.word;
+}
+
+bool is_list(form_t a)
+{
+  assert_word_or_list(a);
+  return a.tag == form_list;
+}
+
+int word_to_int(form_t a)
+{
+  if (a.tag == form_int)
+    return a.number;
+  // words are length delimited, parse like strtol in base 10
+  const char *s = a.word;
+  const ssize_t len = a.len;
+  const bool negative = len > 0 && s[0] == '-';
+  ssize_t i = negative ? 1 : 0;
+  program_assert(i < len, "word_to_int requires a decimal word");
+  long long a_val = 0;
+  for (; i < len; i++)
+  {
+    program_assert(s[i] >= '0' && s[i] <= '9', "word_to_int requires a decimal word");
+    if (a_val <= (long long)INT_MAX + 1)
+      a_val = a_val * 10 + (s[i] - '0');
+  }
+  if (negative)
+    a_val = -a_val;
+  program_assert(a_val <= INT_MAX && a_val >= INT_MIN, "word_to_int overflow");
+  return a_val;
+}
+
+#define BUILTIN_TWO_DECIMAL_OP(name, op)                  \
+  form_t name(form_t a, form_t b)                         \
+  {                                                       \
+    if (a.tag == form_int && b.tag == form_int)           \
+      return word_from_int(a.number op b.number);         \
+    return word_from_int(word_to_int(a) op word_to_int(b)); \
+  }
+
+BUILTIN_TWO_DECIMAL_OP(bi_add, +)
+BUILTIN_TWO_DECIMAL_OP(bi_sub, -)
+BUILTIN_TWO_DECIMAL_OP(bi_bit_and, &)
+BUILTIN_TWO_DECIMAL_OP(bi_bit_or, |)
+BUILTIN_TWO_DECIMAL_OP(bi_bit_xor, ^)
+BUILTIN_TWO_DECIMAL_OP(bi_bit_shift_left, <<)
+BUILTIN_TWO_DECIMAL_OP(bi_bit_shift_right_unsigned, >>)
+
+int bit_shift_right_signed(int v, int shift)
+{
+  int result = v >> shift;
+  if (v >= 0)
+    return result;
+  return (result | (~0 << (sizeof(int) * CHAR_BIT - shift)));
+}
+
+form_t bi_bit_shift_right_signed(form_t a, form_t b)
+{
+  return word_from_int(bit_shift_right_signed(word_to_int(a), word_to_int(b)));
+}
+
+form_t bi_eq(form_t a, form_t b)
+{
+  program_assert(is_word(a) && is_word(b), "eq requires words");
+  if (a.tag == form_word && b.tag == form_word)
+    return a.word == b.word ? one : zero;
+  if (a.tag == form_int && b.tag == form_int)
+    return a.number == b.number ? one : zero;
+  // an int and a word are equal if the word is its text
+  char a_buf[12], b_buf[12];
+  ssize_t a_len, b_len;
+  const char *a_chars = word_chars(a, a_buf, &a_len);
+  const char *b_chars = word_chars(b, b_buf, &b_len);
+  return a_len == b_len && memcmp(a_chars, b_chars, a_len) == 0 ? one : zero;
+}
+
+#define BUILTIN_TWO_DECIMAL_CMP(name, op)                 \
+  form_t name(form_t a, form_t b)                         \
+  {                                                       \
+    if (a.tag == form_int && b.tag == form_int)           \
+      return a.number op b.number ? one : zero;           \
+    return word_to_int(a) op word_to_int(b) ? one : zero; \
+  }
+
+BUILTIN_TWO_DECIMAL_CMP(bi_lt, <)
+BUILTIN_TWO_DECIMAL_CMP(bi_le, <=)
+BUILTIN_TWO_DECIMAL_CMP(bi_ge, >=)
+BUILTIN_TWO_DECIMAL_CMP(bi_gt, >)
+
+form_t bi_is_word(form_t a)
+{
+  return is_word(a) ? one : zero;
+}
+
+form_t bi_is_list(form_t a)
+{
+  return is_list(a) ? one : zero;
+}
+
+form_t bi_size(form_t a)
+{
+  if (a.tag == form_int)
+  {
+    char buf[12];
+    return word_from_int(int_to_chars(a.number, buf));
+  }
+  return word_from_int(a.len);
+}
+
+form_t bi_word_from_codepoints(form_t a)
+{
+  program_assert(is_list(a), "word_from_codepoints requires a list");
+  const int len = a.len;
+  // cleared so the compiler sees it written when the list is empty
+  char stack_word[64] = {0};
+  char *word = len <= (int)sizeof(stack_word) ? stack_word : malloc(len);
+  for (int i = 0; i < len; i++)
+  {
+    form_t codepoint = form_items(a)[i];
+    int cp = word_to_int(codepoint);
+    program_assert(classify_char(cp) == WORD, "word_from_codepoints requires a list of decimal words corresponding to ascii codes for word characters");
+    word[i] = cp;
+  }
+  const char *interned = intern(word, len);
+  if (word != stack_word)
+    free(word);
+  return (form_t){.tag = form_word, .len = len, .word = interned};
+}
+
+form_t bi_log(form_t a)
+{
+  output_chars("wuns: ", 6);
+  print_form(a);
+  output_char('\n');
+  return unit;
+}
+
+form_t bi_abort()
+{
+  program_error("wuns abort\n");
+}
+
+form_t bi_at(form_t a, form_t b)
+{
+  int index = word_to_int(b);
+  char buf[12];
+  ssize_t len = a.len;
+  const char *chars = a.tag == form_int ? word_chars(a, buf, &len) : a.word;
+  program_assert(index >= -len && index < len, "at index out of bounds");
+  if (index < 0)
+    index += len;
+  if (is_list(a))
+    return form_items(a)[index];
+  program_assert(is_word(a), "at requires a list or a word");
+  return word_from_int(chars[index]);
+}
+
+// a view of the elements from start to end of list, it shares the backing array so no forms are copied
+form_t slice(form_t list, int start, int end)
+{
+  const int len = list.len;
+  // do it like in js https://developer.mozilla.org/en-US/docs/Web/JavaScript/Reference/Global_Objects/Array/slice
+  // as ousterhout says as well don't throw errors, just return empty list
+  if (start >= len)
+    return unit;
+  if (start < -len)
+    start = 0;
+  else if (start < 0)
+    start = len + start;
+
+  if (end == 0 || end < -len)
+    return unit;
+  if (end > len)
+    end = len;
+  else if (end < 0)
+    end = len + end;
+
+  const int length = end - start;
+  if (length <= 0)
+    return unit;
+  return (form_t){.tag = form_list, .off = list.off + start, .len = length, .forms = list.forms};
+}
+
+form_t bi_slice(form_t v, form_t i, form_t j)
+{
+  program_assert(is_list(v), "slice requires a list");
+  const int start = word_to_int(i);
+  const int end = word_to_int(j);
+  return slice(v, start, end);
+}
+
+// copy every list on concat instead of appending in place, to compare against
+bool flat_concat = false;
+
+form_t bi_concat(size_t n, form_t *forms)
+{
+  ssize_t total_length = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    program_assert(is_list(forms[i]), "concat requires lists");
+    total_length += forms[i].len;
+  }
+  if (total_length == 0)
+    return unit;
+  size_t first = 0;
+  while (forms[first].len == 0)
+    first++;
+  const form_t head = forms[first];
+  backing_header_t *header = backing_header(head.forms);
+  form_t *concat_forms;
+  uint32_t off = 0;
+  ssize_t k = 0;
+  if (!flat_concat && head.off + head.len == header->used && header->used + (total_length - head.len) <= header->cap)
+  {
+    // the first list is the longest view of its backing array, append after it without copying it
+    concat_forms = head.forms;
+    off = head.off;
+    k = head.len;
+    first++;
+    header->used += total_length - head.len;
+  }
+  else
+  {
+    // room to double so repeated concat onto the result is amortized constant per element
+    concat_forms = gc_alloc_backing(total_length, flat_concat ? total_length : total_length * 2);
+    k = 0;
+  }
+  form_t *dst = concat_forms + off;
+  for (size_t i = first; i < n; i++)
+  {
+    if (forms[i].len > 0)
+      memcpy(dst + k, form_items(forms[i]), sizeof(form_t) * forms[i].len);
+    k += forms[i].len;
+  }
+  return (form_t){.tag = form_list, .off = off, .len = total_length, .forms = concat_forms};
+}
+
+typedef struct
+{
+  const int parameters;
+  const bool variadic;
+  union
+  {
+    form_t (*func0)();
+    form_t (*func1)(form_t);
+    form_t (*func2)(form_t, form_t);
+    form_t (*func3)(form_t, form_t, form_t);
+    form_t (*funcvar)(size_t, form_t *);
+  };
+} built_in_func_t;
+
+form_t bi_gensym()
+{
+  char result[24];
+  const int len = sprintf(result, "gensym%d", interp->gensym_counter++);
+  return (form_t){.tag = form_word, .len = len, .word = intern(result, len)};
+}
+
+typedef struct
+{
+  const char *name;
+  built_in_func_t func;
+} built_in_func_entry_t;
+
+static const built_in_func_entry_t built_in_funcs[] = {
+    {"abort", {.parameters = 0, .func0 = bi_abort}},
+    {"gensym", {.parameters = 0, .func0 = bi_gensym}},
+
+    {"is-word", {.parameters = 1, .func1 = bi_is_word}},
+    {"is-list", {.parameters = 1, .func1 = bi_is_list}},
+    {"size", {.parameters = 1, .func1 = bi_size}},
+    {"log", {.parameters = 1, .func1 = bi_log}},
 
     {"add", {.parameters = 2, .func2 = bi_add}},
     {"sub", {.parameters = 2, .func2 = bi_sub}},
@@ -464,365 +1567,5182 @@ static const built_in_func_entry_t built_in_funcs[] = {
     {"bit-shift-right-signed", {.parameters = 2, .func2 = bi_bit_shift_right_signed}},
     {"bit-shift-right-unsigned", {.parameters = 2, .func2 = bi_bit_shift_right_unsigned}},
 
-    {"eq", {.parameters = 2, .func2 = bi_eq}},
-    {"lt", {.parameters = 2, .func2 = bi_lt}},
-    {"le", {.parameters = 2, .func2 = bi_le}},
-    {"ge", {.parameters = 2, .func2 = bi_ge}},
-    {"gt", {.parameters = 2, .func2 = bi_gt}},
+    {"eq", {.parameters = 2, .func2 = bi_eq}},
+    {"lt", {.parameters = 2, .func2 = bi_lt}},
+    {"le", {.parameters = 2, .func2 = bi_le}},
+    {"ge", {.parameters = 2, .func2 = bi_ge}},
+    {"gt", {.parameters = 2, .func2 = bi_gt}},
+
+    {"at", {.parameters = 2, .func2 = bi_at}},
+    {"word-from-codepoints", {.parameters = 1, .func1 = bi_word_from_codepoints}},
+
+    {"slice", {.parameters = 3, .func3 = bi_slice}},
+
+    {"concat", {.parameters = 0, .variadic = true, .funcvar = bi_concat}},
+};
+
+#define N_BUILTINS (sizeof(built_in_funcs) / sizeof(built_in_func_entry_t))
+
+// compile time scope, words are resolved to a (depth, index) address
+typedef struct Scope
+{
+  const struct Scope *parent;
+  int len;
+  const char **words;
+  // the scope of a loop body, the target of a cont inside it
+  bool is_loop;
+} Scope_t;
+
+// run time frame, values are addressed by (depth, index)
+typedef struct Env
+{
+  const struct Env *parent;
+  form_t *values;
+} Env_t;
+
+typedef enum
+{
+  node_constant = 1,
+  node_variable,
+  node_unbound,
+  node_malformed,
+  node_if,
+  node_let,
+  node_loop,
+  node_cont,
+  node_builtin_call,
+  node_call,
+  node_macro_call,
+  node_definition,
+} node_kind;
+
+// monomorphic inline cache of a call site, what its name resolved to while definition_epoch was epoch
+// func_macro is NULL when the name resolved to builtin
+typedef struct
+{
+  const struct func_macro *func_macro;
+  const built_in_func_t *builtin;
+  int epoch;
+} call_cache_t;
+
+typedef struct node
+{
+  node_kind kind;
+  union
+  {
+    form_t constant;
+    struct
+    {
+      int depth;
+      int index;
+    } variable;
+    const char *unbound;
+    // message reported when the node is evaluated
+    const char *malformed;
+    struct
+    {
+      const struct node *cond;
+      const struct node *then;
+      const struct node *otherwise;
+    } if_;
+    struct
+    {
+      int n_bindings;
+      const struct node **inits;
+      int n_bodies;
+      const struct node **bodies;
+    } let_loop;
+    // depth of the frame of the innermost loop, -1 if there is none
+    struct
+    {
+      int n_args;
+      const struct node **args;
+      int depth;
+      int n_bindings;
+    } cont;
+    // builtin, func and macro calls, form and scope are kept for macro expansion at run time
+    struct
+    {
+      const char *name;
+      const built_in_func_t *builtin;
+      int n_args;
+      const struct node **args;
+      form_t form;
+      const Scope_t *scope;
+      // region the node lives in, lazily compiled parts go there too
+      arena_t *arena;
+      // cached expansion of a macro call, valid while expansion_epoch is definition_epoch
+      const struct node *expansion;
+      int expansion_epoch;
+      call_cache_t cache;
+    } call;
+    struct
+    {
+      bool is_macro;
+      const char *name;
+      int arity;
+      const char **parameters;
+      const char *rest_param;
+      int n_of_bodies;
+      const form_t *bodies;
+    } definition;
+  };
+} node_t;
+
+typedef struct func_macro
+{
+  const char *name;
+  const bool is_macro;
+  const int arity;
+  const char **parameters;
+  const char *rest_param;
+  const int n_of_bodies;
+  const form_t *bodies;
+  // NULL until the first call for definitions loaded from an image, see func_macro_body_nodes
+  const node_t **body_nodes;
+  // bytecode compiled by the vm engine on first call
+  const struct vm_chunk *chunk;
+  // body_nodes after the definition time optimizer, see func_macro_run_nodes
+  const node_t **optimized_nodes;
+  // definition_epoch they were optimized at, they are optimized again after it when they depend on other definitions
+  int optimized_epoch;
+  bool optimized_depends;
+  // machine code of a func in a program compiled by --emit-c, it takes the parameter values like body_nodes
+  form_t (*native)(form_t *args);
+} FuncMacro;
+
+// a name can have a user definition, a builtin or both, the user definition shadows the builtin
+struct func_macro_binding
+{
+  const char *name;
+  const FuncMacro *func_macro;
+  const built_in_func_t *builtin;
+};
+
+// expand macro calls in func/macro bodies when they are defined instead of at their first call
+bool expand_ahead = false;
+
+size_t hash_symbol(const char *name)
+{
+  // interned names are unique pointers, mix the bits above the alignment
+  return ((uintptr_t)name >> 3) * 11400714819323198485ull >> 16;
+}
+
+// sets value for name, returns the value it had or -1 if it was not in map
+int name_map_put(name_map_t *map, const char *name, int value)
+{
+  if ((map->len + 1) * 2 > map->cap)
+  {
+    const int old_cap = map->cap;
+    const char **old_names = map->names;
+    int *old_values = map->values;
+    map->cap = old_cap == 0 ? 64 : old_cap * 2;
+    map->names = calloc(map->cap, sizeof(char *));
+    map->values = malloc(sizeof(int) * map->cap);
+    map->len = 0;
+    for (int i = 0; i < old_cap; i++)
+      if (old_names[i] != NULL)
+        name_map_put(map, old_names[i], old_values[i]);
+    free(old_names);
+    free(old_values);
+  }
+  const int mask = map->cap - 1;
+  int i = hash_symbol(name) & mask;
+  while (map->names[i] != NULL && map->names[i] != name)
+    i = (i + 1) & mask;
+  const int previous = map->names[i] == NULL ? -1 : map->values[i];
+  if (map->names[i] == NULL)
+    map->len++;
+  map->names[i] = name;
+  map->values[i] = value;
+  return previous;
+}
+
+// the value of name or -1
+int name_map_get(const name_map_t *map, const char *name)
+{
+  if (map->cap == 0)
+    return -1;
+  const int mask = map->cap - 1;
+  for (int i = hash_symbol(name) & mask; map->names[i] != NULL; i = (i + 1) & mask)
+    if (map->names[i] == name)
+      return map->values[i];
+  return -1;
+}
+
+void name_map_clear(name_map_t *map)
+{
+  if (map->len > 0)
+    memset(map->names, 0, sizeof(char *) * map->cap);
+  map->len = 0;
+}
+
+void name_map_free(name_map_t *map)
+{
+  free(map->names);
+  free(map->values);
+  *map = (name_map_t){0};
+}
+
+// the names of map in a new array
+const char **name_map_names(const name_map_t *map)
+{
+  const char **names = malloc(sizeof(char *) * (map->len + 1));
+  int n = 0;
+  for (int i = 0; i < map->cap; i++)
+    if (map->names[i] != NULL)
+      names[n++] = map->names[i];
+  return names;
+}
+
+FuncMacroBinding *find_func_macro_binding(const char *name)
+{
+  if (interp->recorded_lookups != NULL)
+    name_map_put(interp->recorded_lookups, name, 0);
+  if (interp->func_macro_env.cap == 0)
+    return NULL;
+  const int mask = interp->func_macro_env.cap - 1;
+  for (int i = hash_symbol(name) & mask;; i = (i + 1) & mask)
+  {
+    FuncMacroBinding *b = &interp->func_macro_env.bindings[i];
+    if (b->name == name)
+      return b;
+    if (b->name == NULL)
+      return NULL;
+  }
+}
+
+// returns the binding for name, adding an empty one if there is none
+FuncMacroBinding *upsert_func_macro_binding(const char *name)
+{
+  if ((interp->func_macro_env.len + 1) * 2 > interp->func_macro_env.cap)
+  {
+    const int old_cap = interp->func_macro_env.cap;
+    FuncMacroBinding *old_bindings = interp->func_macro_env.bindings;
+    interp->func_macro_env.cap = old_cap == 0 ? 256 : old_cap * 2;
+    interp->func_macro_env.bindings = calloc(interp->func_macro_env.cap, sizeof(FuncMacroBinding));
+    const int mask = interp->func_macro_env.cap - 1;
+    for (int i = 0; i < old_cap; i++)
+    {
+      if (old_bindings[i].name == NULL)
+        continue;
+      int j = hash_symbol(old_bindings[i].name) & mask;
+      while (interp->func_macro_env.bindings[j].name != NULL)
+        j = (j + 1) & mask;
+      interp->func_macro_env.bindings[j] = old_bindings[i];
+    }
+    free(old_bindings);
+  }
+  const int mask = interp->func_macro_env.cap - 1;
+  int i = hash_symbol(name) & mask;
+  while (interp->func_macro_env.bindings[i].name != NULL && interp->func_macro_env.bindings[i].name != name)
+    i = (i + 1) & mask;
+  FuncMacroBinding *b = &interp->func_macro_env.bindings[i];
+  if (b->name == NULL)
+  {
+    *b = (FuncMacroBinding){.name = name, .func_macro = NULL, .builtin = NULL};
+    interp->func_macro_env.len++;
+  }
+  return b;
+}
+
+void register_builtins()
+{
+  for (size_t i = 0; i < N_BUILTINS; i++)
+  {
+    const char *name = intern(built_in_funcs[i].name, strlen(built_in_funcs[i].name));
+    upsert_func_macro_binding(name)->builtin = &built_in_funcs[i].func;
+  }
+}
+
+// a redefinition replaces the previous one, which stays valid for calls in progress
+void insert_func_macro_binding(const char *name, const FuncMacro *func_macro)
+{
+  if (interp->recorded_definitions != NULL)
+    name_map_put(interp->recorded_definitions, name, 0);
+  FuncMacroBinding *b = upsert_func_macro_binding(name);
+  if (b->builtin != NULL && b->func_macro == NULL)
+    interp->shadowed_builtins++;
+  // a macro may call the replaced definition or the builtin a new func shadows, or be the replaced definition
+  // cached expansions and bytecode, which inlines expansions and builtins, are stale then
+  if (b->func_macro != NULL || b->builtin != NULL || func_macro->is_macro)
+    interp->definition_epoch++;
+  b->func_macro = func_macro;
+}
+
+// forgets the user definition of name, calls to it fail again or go to the builtin it shadowed
+void remove_func_macro_binding(const char *name)
+{
+  FuncMacroBinding *b = find_func_macro_binding(name);
+  if (b == NULL || b->func_macro == NULL)
+    return;
+  if (b->builtin != NULL)
+    interp->shadowed_builtins--;
+  b->func_macro = NULL;
+  interp->definition_epoch++;
+}
+
+const FuncMacro *get_func_macro(const char *name)
+{
+  const FuncMacroBinding *b = find_func_macro_binding(name);
+  return b == NULL ? NULL : b->func_macro;
+}
+
+const built_in_func_t *get_builtin(const char *name)
+{
+  const FuncMacroBinding *b = find_func_macro_binding(name);
+  return b == NULL ? NULL : b->builtin;
+}
+
+// the func or macro name refers to, or NULL and its builtin in *builtin, from cache while definition_epoch has not moved
+// a replaced definition or a shadowed builtin moves it, a new name does not so unknown names are never cached
+const FuncMacro *resolve_call(call_cache_t *cache, const char *name, const built_in_func_t **builtin)
+{
+  if (cache->epoch == interp->definition_epoch)
+  {
+    interp->call_cache_hits++;
+    if (interp->recorded_lookups != NULL)
+      name_map_put(interp->recorded_lookups, name, 0);
+    *builtin = cache->builtin;
+    return cache->func_macro;
+  }
+  interp->call_cache_misses++;
+  const FuncMacroBinding *b = find_func_macro_binding(name);
+  const FuncMacro *func_macro = b == NULL ? NULL : b->func_macro;
+  *builtin = b == NULL || func_macro != NULL ? NULL : b->builtin;
+  if (func_macro != NULL || *builtin != NULL)
+    *cache = (call_cache_t){.func_macro = func_macro, .builtin = *builtin, .epoch = interp->definition_epoch};
+  return func_macro;
+}
+
+// makes ip the interpreter of the calling thread, with nothing but the builtins defined
+void interp_init(interp_t *ip, FILE *out)
+{
+  *ip = (interp_t){.node_arena = &ip->transient_arena, .gc = {.threshold = GC_MIN_THRESHOLD}};
+  interp = ip;
+  set_output(out);
+  register_builtins();
+}
+
+// forgets the definitions and data of the current interpreter but keeps its memory for the next program
+// the previous program may have stopped with an error anywhere
+// drops what a program stopped by an error left on the stacks of the current interpreter
+void interp_unwind()
+{
+  interp->node_arena = &interp->transient_arena;
+  interp->gc_roots.len = 0;
+  interp->parse_stack.len = 0;
+  interp->open_lists.len = 0;
+  interp->eval_depth = 0;
+  interp->vm_registers_live = 0;
+  value_segment_t *segment = interp->value_stack;
+  while (segment != NULL)
+  {
+    segment->used = 0;
+    interp->value_stack = segment;
+    segment = segment->below;
+  }
+}
+
+void interp_reset(FILE *out)
+{
+  arena_reset(&interp->permanent_arena);
+  arena_reset(&interp->transient_arena);
+  gc_release_all();
+  interp_unwind();
+  memset(interp->func_macro_env.bindings, 0, sizeof(FuncMacroBinding) * interp->func_macro_env.cap);
+  interp->func_macro_env.len = 0;
+  interp->shadowed_builtins = 0;
+  interp->definition_epoch = 0;
+  interp->not_compilable_epoch = 0;
+  interp->call_site_expansions = 0;
+  interp->not_compilable_expansions = 0;
+  interp->gensym_counter = 0;
+  interp->gc.threshold = GC_MIN_THRESHOLD;
+  set_output(out);
+  register_builtins();
+}
+
+void free_arena_blocks(arena_block_t *block)
+{
+  while (block != NULL)
+  {
+    arena_block_t *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+// releases all memory of the current interpreter, the thread has none afterwards
+void interp_free()
+{
+  gc_release_all();
+  free_arena_blocks(interp->permanent_arena.head);
+  free_arena_blocks(interp->permanent_arena.free_blocks);
+  free_arena_blocks(interp->transient_arena.head);
+  free_arena_blocks(interp->transient_arena.free_blocks);
+  free(interp->gc_roots.ranges);
+  free(interp->gc_mark_stack.headers);
+  free(interp->parse_stack.forms);
+  free(interp->open_lists.bases);
+  free(interp->print_stack.frames);
+  free(interp->output.data);
+  free(interp->func_macro_env.bindings);
+  free(interp->vm_registers);
+  free(interp->vm_frames);
+  value_segment_t *segment = interp->value_stack;
+  while (segment != NULL && segment->above != NULL)
+    segment = segment->above;
+  while (segment != NULL)
+  {
+    value_segment_t *below = segment->below;
+    free(segment);
+    segment = below;
+  }
+  interp = NULL;
+}
+
+node_t *new_node(node_kind kind)
+{
+  node_t *node = arena_alloc(interp->node_arena, sizeof(node_t));
+  node->kind = kind;
+  return node;
+}
+
+const node_t **new_nodes(int n)
+{
+  return n == 0 ? NULL : arena_alloc(interp->node_arena, sizeof(node_t *) * n);
+}
+
+const Scope_t *new_scope(const Scope_t *parent, int len, const char **words)
+{
+  Scope_t *scope = arena_alloc(interp->node_arena, sizeof(Scope_t));
+  *scope = (Scope_t){.parent = parent, .len = len, .words = words, .is_loop = false};
+  return scope;
+}
+
+const Scope_t *new_loop_scope(const Scope_t *parent, int len, const char **words)
+{
+  Scope_t *scope = (Scope_t *)new_scope(parent, len, words);
+  scope->is_loop = true;
+  return scope;
+}
+
+const node_t *compile(form_t form, const Scope_t *scope);
+
+const node_t **compile_all(int n, const form_t *forms, const Scope_t *scope)
+{
+  const node_t **nodes = new_nodes(n);
+  for (int i = 0; i < n; i++)
+    nodes[i] = compile(forms[i], scope);
+  return nodes;
+}
+
+const node_t *compile_word(const char *word, const Scope_t *scope)
+{
+  int depth = 0;
+  for (const Scope_t *s = scope; s != NULL; s = s->parent, depth++)
+    for (int i = 0; i < s->len; i++)
+      if (word == s->words[i])
+      {
+        node_t *node = new_node(node_variable);
+        node->variable.depth = depth;
+        node->variable.index = i;
+        return node;
+      }
+  // report at run time, the word may never be evaluated
+  node_t *node = new_node(node_unbound);
+  node->unbound = word;
+  return node;
+}
+
+const node_t *compile_let_loop(bool is_let, form_t form, const Scope_t *scope)
+{
+  const int length = form.len;
+  const form_t *forms = form_items(form);
+  program_assert(length >= 2, "let/loop must have at least two arguments");
+  form_t binding_form = forms[1];
+  program_assert(is_list(binding_form), "let/loop and loop bindings must be a list");
+  const int binding_length = binding_form.len;
+  program_assert(binding_length % 2 == 0, "let/loop bindings must be a list of even length");
+  const form_t *binding_forms = form_items(binding_form);
+  const int number_of_bindings = binding_length / 2;
+  const char **words = number_of_bindings == 0 ? NULL : arena_alloc(interp->node_arena, sizeof(char *) * number_of_bindings);
+  const node_t **inits = new_nodes(number_of_bindings);
+  for (int i = 0; i < number_of_bindings; i++)
+  {
+    program_assert(is_word(binding_forms[i * 2]), "let/loop bindings must be words");
+    words[i] = word_symbol(binding_forms[i * 2]);
+    // a binding sees the ones before it
+    inits[i] = compile(binding_forms[i * 2 + 1], new_scope(scope, i, words));
+  }
+  node_t *node = new_node(is_let ? node_let : node_loop);
+  node->let_loop.n_bindings = number_of_bindings;
+  node->let_loop.inits = inits;
+  node->let_loop.n_bodies = length - 2;
+  const Scope_t *body_scope = is_let ? new_scope(scope, number_of_bindings, words)
+                                     : new_loop_scope(scope, number_of_bindings, words);
+  node->let_loop.bodies = compile_all(length - 2, forms + 2, body_scope);
+  return node;
+}
+
+const node_t *compile_definition(bool is_macro, form_t form)
+{
+  const int length = form.len;
+  const form_t *forms = form_items(form);
+  program_assert(length >= 3, "func/macro must have at least two arguments");
+  const form_t fname = forms[1];
+  program_assert(is_word(fname), "func/macro name must be a word");
+  const form_t params = forms[2];
+  program_assert(is_list(params), "func/macro params must be a list");
+  const int param_length = params.len;
+  for (int i = 0; i < param_length; i++)
+  {
+    program_assert(is_word(form_items(params)[i]), "func/macro params must be words");
+  }
+  const char *rest_param = NULL;
+  int arity;
+  if (param_length >= 2 && word_symbol(form_items(params)[param_length - 2]) == sym_rest)
+  {
+    rest_param = word_symbol(form_items(params)[param_length - 1]);
+    arity = param_length - 2;
+  }
+  else
+  {
+    arity = param_length;
+  }
+  // the rest parameter goes last so the body scope is just the parameters
+  const char **parameters = arena_alloc(interp->node_arena, (arity + 1) * sizeof(char *));
+  for (int i = 0; i < arity; i++)
+    parameters[i] = word_symbol(form_items(params)[i]);
+  parameters[arity] = rest_param;
+  node_t *node = new_node(node_definition);
+  node->definition.is_macro = is_macro;
+  node->definition.name = word_symbol(fname);
+  node->definition.arity = arity;
+  node->definition.parameters = parameters;
+  node->definition.rest_param = rest_param;
+  node->definition.n_of_bodies = length - 3;
+  node->definition.bodies = forms + 3;
+  return node;
+}
+
+const node_t *expand_call_site(const node_t *node, const FuncMacro *func_macro);
+
+const node_t *compile_call(form_t form, const Scope_t *scope)
+{
+  const char *first_word = word_symbol(form_items(form)[0]);
+  const int number_of_given_args = form.len - 1;
+  const FuncMacro *func_macro = get_func_macro(first_word);
+  const built_in_func_t *builtin = func_macro == NULL ? get_builtin(first_word) : NULL;
+  node_kind kind = node_call;
+  if (func_macro != NULL && func_macro->is_macro)
+    kind = node_macro_call;
+  else if (builtin != NULL && (builtin->variadic || builtin->parameters == number_of_given_args))
+    kind = node_builtin_call;
+  node_t *node = new_node(kind);
+  node->call.name = first_word;
+  node->call.builtin = builtin;
+  node->call.n_args = number_of_given_args;
+  // macro arguments are not evaluated, a call that turns out to be a func at run time compiles them then
+  node->call.args = kind == node_macro_call ? NULL : compile_all(number_of_given_args, form_items(form) + 1, scope);
+  node->call.form = form;
+  node->call.scope = scope;
+  node->call.arena = interp->node_arena;
+  node->call.expansion = NULL;
+  node->call.expansion_epoch = 0;
+  node->call.cache = (call_cache_t){.epoch = -1};
+  if (kind == node_macro_call && expand_ahead && interp->node_arena == &interp->permanent_arena)
+    expand_call_site(node, func_macro);
+  return node;
+}
+
+// translate a form into a tree of nodes with special forms decoded, words resolved to frame addresses and builtins resolved
+const node_t *compile(form_t form, const Scope_t *scope)
+{
+  if (is_word(form))
+    return compile_word(word_symbol(form), scope);
+  assert(is_list(form) && "compile requires a list at this point");
+
+  const int length = form.len;
+  if (length == 0)
+  {
+    node_t *node = new_node(node_constant);
+    node->constant = unit;
+    return node;
+  }
+  const form_t *forms = form_items(form);
+  const form_t first = forms[0];
+  if (!is_word(first))
+  {
+    // report at run time like unbound words, the list may never be evaluated
+    node_t *node = new_node(node_malformed);
+    node->malformed = "first element a list must be a word";
+    return node;
+  }
+  const char *first_word = word_symbol(first);
+  if (first_word == sym_quote)
+  {
+    program_assert(length == 2, "quote takes exactly one argument");
+    node_t *node = new_node(node_constant);
+    node->constant = forms[1];
+    // a quoted decimal is indistinguishable from its int form, which arithmetic consumes without parsing
+    int number;
+    if (forms[1].tag == form_word && word_is_canonical_int(forms[1].word, forms[1].len, &number))
+      node->constant = word_from_int(number);
+    return node;
+  }
+  if (first_word == sym_if)
+  {
+    program_assert(length == 4, "if takes three arguments");
+    node_t *node = new_node(node_if);
+    node->if_.cond = compile(forms[1], scope);
+    node->if_.then = compile(forms[2], scope);
+    node->if_.otherwise = compile(forms[3], scope);
+    return node;
+  }
+  if (first_word == sym_let || first_word == sym_loop)
+    return compile_let_loop(first_word == sym_let, form, scope);
+  if (first_word == sym_cont)
+  {
+    node_t *node = new_node(node_cont);
+    node->cont.n_args = length - 1;
+    node->cont.args = compile_all(length - 1, forms + 1, scope);
+    node->cont.depth = -1;
+    node->cont.n_bindings = 0;
+    int depth = 0;
+    for (const Scope_t *s = scope; s != NULL; s = s->parent, depth++)
+      if (s->is_loop)
+      {
+        node->cont.depth = depth;
+        node->cont.n_bindings = s->len;
+        break;
+      }
+    return node;
+  }
+  if (first_word == sym_func || first_word == sym_macro)
+    return compile_definition(first_word == sym_macro, form);
+  return compile_call(form, scope);
+}
+
+// the compiled bodies of a func/macro, definitions loaded from an image are compiled when first called
+const node_t **func_macro_body_nodes(const FuncMacro *func_macro)
+{
+  if (func_macro->body_nodes != NULL || func_macro->n_of_bodies == 0)
+    return func_macro->body_nodes;
+  arena_t *prev_node_arena = interp->node_arena;
+  interp->node_arena = &interp->permanent_arena;
+  const int number_of_params = func_macro->arity + (func_macro->rest_param == NULL ? 0 : 1);
+  const Scope_t *scope = new_scope(NULL, number_of_params, func_macro->parameters);
+  ((FuncMacro *)func_macro)->body_nodes = compile_all(func_macro->n_of_bodies, func_macro->bodies, scope);
+  interp->node_arena = prev_node_arena;
+  return func_macro->body_nodes;
+}
+
+// opt-in profiler, calls push a frame on a shadow stack which is timed when the call returns and sampled on SIGPROF
+typedef struct
+{
+  // the interned name of a func/macro or the built_in_func_t of a builtin
+  const void *key;
+  const char *name;
+  int name_len;
+  bool is_builtin;
+  uint32_t id;
+  uint64_t calls;
+  uint64_t inclusive_ns;
+  uint64_t exclusive_ns;
+  uint64_t allocations;
+  uint64_t bytes;
+  // frames of this entry on the stack, inclusive time of recursive calls is only counted by the outermost
+  int active;
+} profile_entry_t;
+
+typedef struct
+{
+  profile_entry_t *entry;
+  uint64_t start_ns;
+  uint64_t child_ns;
+  size_t start_allocations;
+  size_t start_bytes;
+  size_t child_allocations;
+  size_t child_bytes;
+} profile_frame_t;
+
+#define PROFILE_MAX_DEPTH (1 << 18)
+// samples deeper than this keep their outermost frames
+#define PROFILE_MAX_SAMPLE_DEPTH 512
+#define PROFILE_SAMPLE_WORDS (1 << 24)
+#define PROFILE_SAMPLE_INTERVAL_US 1000
+
+bool profiling = false;
+
+struct
+{
+  int cap;
+  int len;
+  // open addressing by key
+  profile_entry_t **table;
+  // by id
+  profile_entry_t **entries;
+} profile_entries = {.cap = 0, .len = 0, .table = NULL, .entries = NULL};
+
+profile_frame_t *profile_stack = NULL;
+// read by the signal handler, frames below it are complete
+volatile int profile_depth = 0;
+
+// each sample is its depth followed by the entry ids of its frames, outermost first
+uint32_t *profile_samples = NULL;
+volatile size_t profile_samples_len = 0;
+volatile size_t profile_dropped_samples = 0;
+const char *profile_stacks_filename = NULL;
+
+uint64_t profile_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// the entry of a func keyed by its interned name or of a builtin, a name length is only looked up for a new entry
+profile_entry_t *profile_entry(const void *key, const char *name, bool is_builtin)
+{
+  if ((profile_entries.len + 1) * 2 > profile_entries.cap)
+  {
+    const int old_cap = profile_entries.cap;
+    profile_entry_t **old_table = profile_entries.table;
+    profile_entries.cap = old_cap == 0 ? 256 : old_cap * 2;
+    profile_entries.table = calloc(profile_entries.cap, sizeof(profile_entry_t *));
+    profile_entries.entries = realloc(profile_entries.entries, sizeof(profile_entry_t *) * profile_entries.cap);
+    for (int i = 0; i < old_cap; i++)
+    {
+      if (old_table[i] == NULL)
+        continue;
+      int j = hash_bytes((const char *)&old_table[i]->key, sizeof(void *)) & (profile_entries.cap - 1);
+      while (profile_entries.table[j] != NULL)
+        j = (j + 1) & (profile_entries.cap - 1);
+      profile_entries.table[j] = old_table[i];
+    }
+    free(old_table);
+  }
+  int i = hash_bytes((const char *)&key, sizeof(void *)) & (profile_entries.cap - 1);
+  for (; profile_entries.table[i] != NULL; i = (i + 1) & (profile_entries.cap - 1))
+    if (profile_entries.table[i]->key == key)
+      return profile_entries.table[i];
+  profile_entry_t *entry = calloc(1, sizeof(profile_entry_t));
+  entry->key = key;
+  entry->name = name;
+  entry->name_len = is_builtin ? (int)strlen(name) : symbol_length(name);
+  entry->is_builtin = is_builtin;
+  entry->id = profile_entries.len;
+  profile_entries.entries[profile_entries.len++] = entry;
+  profile_entries.table[i] = entry;
+  return entry;
+}
+
+void profile_enter(profile_entry_t *entry)
+{
+  if (profile_depth == PROFILE_MAX_DEPTH)
+  {
+    flush_output();
+    printf("Error: profiler stack overflow\n");
+    exit(1);
+  }
+  entry->calls++;
+  entry->active++;
+  profile_stack[profile_depth] = (profile_frame_t){
+      .entry = entry,
+      .start_ns = profile_now(),
+      .start_allocations = interp->arena_allocation_count,
+      .start_bytes = interp->arena_allocated_bytes,
+  };
+  // the frame is complete before the handler can see it
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  profile_depth++;
+}
+
+void profile_exit()
+{
+  const profile_frame_t frame = profile_stack[profile_depth - 1];
+  profile_depth--;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  const uint64_t inclusive_ns = profile_now() - frame.start_ns;
+  const size_t allocations = interp->arena_allocation_count - frame.start_allocations;
+  const size_t bytes = interp->arena_allocated_bytes - frame.start_bytes;
+  profile_entry_t *entry = frame.entry;
+  entry->exclusive_ns += inclusive_ns - frame.child_ns;
+  entry->allocations += allocations - frame.child_allocations;
+  entry->bytes += bytes - frame.child_bytes;
+  if (--entry->active == 0)
+    entry->inclusive_ns += inclusive_ns;
+  if (profile_depth > 0)
+  {
+    profile_frame_t *parent = &profile_stack[profile_depth - 1];
+    parent->child_ns += inclusive_ns;
+    parent->child_allocations += allocations;
+    parent->child_bytes += bytes;
+  }
+}
+
+profile_entry_t *profile_func_entry(const char *name)
+{
+  return profile_entry(name, name, false);
+}
+
+profile_entry_t *profile_builtin_entry(const built_in_func_t *builtin)
+{
+  const built_in_func_entry_t *builtin_entry =
+      (const built_in_func_entry_t *)((const char *)builtin - offsetof(built_in_func_entry_t, func));
+  return profile_entry(builtin, builtin_entry->name, true);
+}
+
+void profile_sample(int signal)
+{
+  (void)signal;
+  const int depth = profile_depth;
+  const int n = depth < PROFILE_MAX_SAMPLE_DEPTH ? depth : PROFILE_MAX_SAMPLE_DEPTH;
+  size_t len = profile_samples_len;
+  if (len + n + 1 > PROFILE_SAMPLE_WORDS)
+  {
+    profile_dropped_samples++;
+    return;
+  }
+  profile_samples[len++] = n;
+  for (int i = 0; i < n; i++)
+    profile_samples[len++] = profile_stack[i].entry->id;
+  profile_samples_len = len;
+}
+
+void profile_start(bool sample_stacks)
+{
+  profiling = true;
+  profile_stack = malloc(sizeof(profile_frame_t) * PROFILE_MAX_DEPTH);
+  if (!sample_stacks)
+    return;
+  profile_samples = malloc(sizeof(uint32_t) * PROFILE_SAMPLE_WORDS);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = profile_sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+  const struct itimerval interval = {
+      .it_interval = {.tv_sec = 0, .tv_usec = PROFILE_SAMPLE_INTERVAL_US},
+      .it_value = {.tv_sec = 0, .tv_usec = PROFILE_SAMPLE_INTERVAL_US},
+  };
+  setitimer(ITIMER_PROF, &interval, NULL);
+}
+
+int compare_samples(const void *a, const void *b)
+{
+  const uint32_t *x = profile_samples + *(const size_t *)a, *y = profile_samples + *(const size_t *)b;
+  for (uint32_t i = 1; i <= x[0] && i <= y[0]; i++)
+    if (x[i] != y[i])
+      return x[i] < y[i] ? -1 : 1;
+  return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// one line per distinct stack, frames separated by ; followed by the number of samples
+void profile_write_stacks(FILE *out)
+{
+  size_t n_samples = 0;
+  for (size_t i = 0; i < profile_samples_len; i += profile_samples[i] + 1)
+    n_samples++;
+  size_t *offsets = malloc(sizeof(size_t) * (n_samples + 1));
+  size_t k = 0;
+  for (size_t i = 0; i < profile_samples_len; i += profile_samples[i] + 1)
+    offsets[k++] = i;
+  qsort(offsets, n_samples, sizeof(size_t), compare_samples);
+  for (size_t i = 0; i < n_samples;)
+  {
+    size_t j = i + 1;
+    while (j < n_samples && compare_samples(&offsets[i], &offsets[j]) == 0)
+      j++;
+    const uint32_t *sample = profile_samples + offsets[i];
+    fprintf(out, "[top-level]");
+    for (uint32_t f = 1; f <= sample[0]; f++)
+    {
+      const profile_entry_t *entry = profile_entries.entries[sample[f]];
+      fprintf(out, ";%.*s", entry->name_len, entry->name);
+    }
+    fprintf(out, " %zu\n", j - i);
+    i = j;
+  }
+  free(offsets);
+}
+
+int compare_profile_entries(const void *a, const void *b)
+{
+  const profile_entry_t *x = *(profile_entry_t *const *)a, *y = *(profile_entry_t *const *)b;
+  return (x->exclusive_ns < y->exclusive_ns) - (x->exclusive_ns > y->exclusive_ns);
+}
+
+void profile_finish()
+{
+  if (!profiling)
+    return;
+  profiling = false;
+  if (profile_samples != NULL)
+  {
+    const struct itimerval off = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &off, NULL);
+    FILE *out = fopen(profile_stacks_filename, "w");
+    if (out == NULL)
+    {
+      fprintf(stderr, "Error: could not open %s\n", profile_stacks_filename);
+      exit(1);
+    }
+    profile_write_stacks(out);
+    fclose(out);
+    if (profile_dropped_samples > 0)
+      fprintf(stderr, "profile: dropped %zu samples\n", (size_t)profile_dropped_samples);
+  }
+  profile_entry_t **sorted = malloc(sizeof(profile_entry_t *) * (profile_entries.len + 1));
+  memcpy(sorted, profile_entries.entries, sizeof(profile_entry_t *) * profile_entries.len);
+  qsort(sorted, profile_entries.len, sizeof(profile_entry_t *), compare_profile_entries);
+  fprintf(stderr, "%12s %12s %12s %12s %12s  %s\n", "calls", "incl ms", "excl ms", "allocs", "bytes", "name");
+  for (int i = 0; i < profile_entries.len; i++)
+  {
+    const profile_entry_t *e = sorted[i];
+    fprintf(stderr, "%12llu %12.3f %12.3f %12llu %12llu  %.*s%s\n", (unsigned long long)e->calls, e->inclusive_ns / 1e6,
+            e->exclusive_ns / 1e6, (unsigned long long)e->allocations, (unsigned long long)e->bytes, e->name_len, e->name,
+            e->is_builtin ? " (builtin)" : "");
+  }
+  free(sorted);
+}
+
+// eval recurses on the native stack for every func call, calls deeper than max_depth or close to the end of the native stack stop with an error
+#define DEFAULT_MAX_DEPTH (1 << 20)
+#define NATIVE_STACK_RESERVE (256 * 1024)
+
+int max_depth = DEFAULT_MAX_DEPTH;
+
+// the stack size of the main thread, batch workers get the same
+size_t native_stack_size()
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    return limit.rlim_cur;
+  return 8 * 1024 * 1024;
+}
+
+void init_native_stack(const char *base)
+{
+  const size_t size = native_stack_size();
+  interp->native_stack_base = base;
+  interp->native_stack_budget = size > 2 * NATIVE_STACK_RESERVE ? size - NATIVE_STACK_RESERVE : size / 2;
+}
+
+void check_eval_depth()
+{
+  const char here = 0;
+  if (interp->eval_depth > max_depth)
+    program_error("Error: call depth exceeds %d, see --max-depth\n", max_depth);
+  if (interp->native_stack_base != NULL && (size_t)(interp->native_stack_base - &here) > interp->native_stack_budget)
+    program_error("Error: eval ran out of native stack at call depth %d, --engine=vm keeps its frames on the heap\n", interp->eval_depth);
+}
+
+form_t eval(const node_t *node, const Env_t *env);
+
+form_t eval_bodies(int n, const node_t **bodies, const Env_t *env)
+{
+  form_t result = unit;
+  for (int i = 0; i < n; i++)
+    result = eval(bodies[i], env);
+  return result;
+}
+
+form_t invoke_builtin(const char *name, const built_in_func_t *builtin, int number_of_given_args, form_t *args)
+{
+  if (builtin->variadic)
+    return builtin->funcvar(number_of_given_args, args);
+  program_assert(builtin->parameters == number_of_given_args, "builtin arity mismatch");
+  switch (number_of_given_args)
+  {
+  case 0:
+    return builtin->func0();
+  case 1:
+    return builtin->func1(args[0]);
+  case 2:
+    return builtin->func2(args[0], args[1]);
+  case 3:
+    return builtin->func3(args[0], args[1], args[2]);
+  default:
+    program_error("Error: unknown builtin function %.*s with arity %d\n", symbol_length(name), name, number_of_given_args);
+  }
+}
+
+// definition time optimizer, rewrites the body nodes of a func into new nodes in the permanent region
+// builtins of constants are folded, an if on a constant becomes its branch and calls of small funcs are inlined
+// the result is valid while definition_epoch stays, replacing a func or shadowing a builtin moves it and the func is optimized again on its next call
+bool optimize_funcs = true;
+
+// size in nodes of the bodies of a func that is inlined, and how deep inlined bodies inline again
+#define OPT_INLINE_MAX_NODES 24
+#define OPT_INLINE_MAX_DEPTH 3
+
+// what a variable of a frame reads, a constant or the slot index of the frame at level at run time
+typedef struct
+{
+  bool is_constant;
+  form_t constant;
+  int level;
+  int index;
+} opt_slot_t;
+
+// a frame of the nodes being optimized, a virtual frame is not there at run time, its slots are constants or other frames
+typedef struct
+{
+  bool is_virtual;
+  int level;
+  opt_slot_t *slots;
+} opt_frame_t;
+
+typedef struct
+{
+  opt_frame_t *frames;
+  int n_frames;
+  int cap_frames;
+  // frames there are at run time around the node being optimized
+  int levels;
+  int inline_depth;
+  // set once the result relies on the definitions of other funcs or builtins
+  bool depends;
+} optimizer_t;
+
+void opt_push_frame(optimizer_t *o, bool is_virtual, int n)
+{
+  if (o->n_frames == o->cap_frames)
+  {
+    o->cap_frames = o->cap_frames == 0 ? 16 : o->cap_frames * 2;
+    o->frames = realloc(o->frames, sizeof(opt_frame_t) * o->cap_frames);
+  }
+  opt_frame_t *frame = &o->frames[o->n_frames++];
+  frame->is_virtual = is_virtual;
+  frame->level = o->levels;
+  frame->slots = n == 0 ? NULL : arena_alloc(&interp->transient_arena, sizeof(opt_slot_t) * n);
+  for (int i = 0; i < n; i++)
+    frame->slots[i] = (opt_slot_t){.is_constant = false, .level = o->levels, .index = i};
+  if (!is_virtual)
+    o->levels++;
+}
+
+void opt_pop_frame(optimizer_t *o)
+{
+  if (!o->frames[--o->n_frames].is_virtual)
+    o->levels--;
+}
+
+const node_t *opt_constant(form_t constant)
+{
+  node_t *node = new_node(node_constant);
+  node->constant = constant;
+  return node;
+}
+
+const node_t *opt_variable(const optimizer_t *o, int level, int index)
+{
+  node_t *node = new_node(node_variable);
+  node->variable.depth = o->levels - 1 - level;
+  node->variable.index = index;
+  return node;
+}
+
+// the number of nodes of bodies, counting stops at limit
+int opt_count_nodes(int n, const node_t **bodies, int limit);
+
+int opt_node_count(const node_t *node, int limit)
+{
+  switch (node->kind)
+  {
+  case node_if:
+  {
+    int count = 1 + opt_node_count(node->if_.cond, limit);
+    count += count < limit ? opt_node_count(node->if_.then, limit) : 0;
+    return count + (count < limit ? opt_node_count(node->if_.otherwise, limit) : 0);
+  }
+  case node_let:
+  case node_loop:
+  {
+    const int count = 1 + opt_count_nodes(node->let_loop.n_bindings, node->let_loop.inits, limit);
+    return count + (count < limit ? opt_count_nodes(node->let_loop.n_bodies, node->let_loop.bodies, limit) : 0);
+  }
+  case node_cont:
+    return 1 + opt_count_nodes(node->cont.n_args, node->cont.args, limit);
+  case node_builtin_call:
+  case node_call:
+  case node_macro_call:
+    return 1 + (node->call.args == NULL ? node->call.n_args : opt_count_nodes(node->call.n_args, node->call.args, limit));
+  default:
+    return 1;
+  }
+}
+
+int opt_count_nodes(int n, const node_t **bodies, int limit)
+{
+  int count = 0;
+  for (int i = 0; i < n && count < limit; i++)
+    count += opt_node_count(bodies[i], limit);
+  return count;
+}
+
+// whether bodies call name or anything the frames around them matter to
+// macro calls and calls compiled as one are compiled later in the scope they were written in, which has to match the frames at run time
+bool opt_any_calls(int n, const node_t **bodies, const char *name);
+
+bool opt_calls(const node_t *node, const char *name)
+{
+  switch (node->kind)
+  {
+  case node_if:
+    return opt_calls(node->if_.cond, name) || opt_calls(node->if_.then, name) || opt_calls(node->if_.otherwise, name);
+  case node_let:
+  case node_loop:
+    return opt_any_calls(node->let_loop.n_bindings, node->let_loop.inits, name) || opt_any_calls(node->let_loop.n_bodies, node->let_loop.bodies, name);
+  case node_cont:
+    return opt_any_calls(node->cont.n_args, node->cont.args, name);
+  case node_builtin_call:
+  case node_call:
+  case node_macro_call:
+  {
+    if (node->call.name == name || node->kind == node_macro_call || node->call.args == NULL)
+      return true;
+    const FuncMacro *func_macro = get_func_macro(node->call.name);
+    return (func_macro != NULL && func_macro->is_macro) || opt_any_calls(node->call.n_args, node->call.args, name);
+  }
+  default:
+    return false;
+  }
+}
+
+bool opt_any_calls(int n, const node_t **bodies, const char *name)
+{
+  for (int i = 0; i < n; i++)
+    if (opt_calls(bodies[i], name))
+      return true;
+  return false;
+}
+
+// builtins without effects that cannot fail on these arguments
+bool opt_foldable(const built_in_func_t *builtin, int n, const node_t **args)
+{
+  if (builtin->variadic || builtin->parameters != n)
+    return false;
+  for (int i = 0; i < n; i++)
+    if (args[i]->kind != node_constant)
+      return false;
+  if (n == 1)
+    return builtin->func1 == bi_is_word || builtin->func1 == bi_is_list || builtin->func1 == bi_size;
+  if (n != 2)
+    return false;
+  const form_t a = args[0]->constant, b = args[1]->constant;
+  if (builtin->func2 == bi_eq)
+    return is_word(a) && is_word(b);
+  const bool arithmetic = builtin->func2 == bi_add || builtin->func2 == bi_sub || builtin->func2 == bi_bit_and || builtin->func2 == bi_bit_or ||
+                          builtin->func2 == bi_bit_xor || builtin->func2 == bi_lt || builtin->func2 == bi_le || builtin->func2 == bi_ge || builtin->func2 == bi_gt;
+  return arithmetic && a.tag == form_int && b.tag == form_int;
+}
+
+const node_t *opt_node(optimizer_t *o, const node_t *node);
+
+const node_t **opt_nodes(optimizer_t *o, int n, const node_t **nodes)
+{
+  const node_t **optimized = new_nodes(n);
+  for (int i = 0; i < n; i++)
+    optimized[i] = opt_node(o, nodes[i]);
+  return optimized;
+}
+
+// a call of callee with args evaluated where the call is, callee has no rest parameter and one parameter per argument
+const node_t *opt_inline(optimizer_t *o, const FuncMacro *callee, const node_t **args, const node_t **optimized_args)
+{
+  const int n = callee->arity;
+  const node_t **bodies = func_macro_body_nodes(callee);
+  bool is_virtual = callee->n_of_bodies == 1 && !opt_any_calls(1, bodies, NULL);
+  for (int i = 0; i < n && is_virtual; i++)
+    is_virtual = optimized_args[i]->kind == node_constant || optimized_args[i]->kind == node_variable;
+  o->depends = true;
+  o->inline_depth++;
+  const node_t *result;
+  if (is_virtual)
+  {
+    // the parameters read the arguments directly
+    opt_push_frame(o, true, n);
+    for (int i = 0; i < n; i++)
+    {
+      const node_t *arg = optimized_args[i];
+      o->frames[o->n_frames - 1].slots[i] = arg->kind == node_constant
+                                                ? (opt_slot_t){.is_constant = true, .constant = arg->constant}
+                                                : (opt_slot_t){.is_constant = false, .level = o->levels - 1 - arg->variable.depth, .index = arg->variable.index};
+    }
+    result = opt_node(o, bodies[0]);
+    opt_pop_frame(o);
+  }
+  else
+  {
+    // a let of the parameters, its bindings are evaluated inside it so they see one more frame
+    node_t *let = new_node(node_let);
+    o->levels++;
+    let->let_loop.inits = opt_nodes(o, n, args);
+    o->levels--;
+    let->let_loop.n_bindings = n;
+    opt_push_frame(o, false, n);
+    let->let_loop.n_bodies = callee->n_of_bodies;
+    let->let_loop.bodies = opt_nodes(o, callee->n_of_bodies, bodies);
+    opt_pop_frame(o);
+    result = let;
+  }
+  o->inline_depth--;
+  return result;
+}
+
+const node_t *opt_call(optimizer_t *o, const node_t *node)
+{
+  if (node->kind == node_macro_call || node->call.args == NULL)
+    return node;
+  const int n = node->call.n_args;
+  const node_t **args = opt_nodes(o, n, node->call.args);
+  const FuncMacro *func_macro = get_func_macro(node->call.name);
+  if (node->kind == node_builtin_call && func_macro == NULL && opt_foldable(node->call.builtin, n, args))
+  {
+    o->depends = true;
+    form_t values[3];
+    for (int i = 0; i < n; i++)
+      values[i] = args[i]->constant;
+    return opt_constant(invoke_builtin(node->call.name, node->call.builtin, n, values));
+  }
+  // the profiler reports calls as they were written
+  if (node->kind == node_call && func_macro != NULL && !func_macro->is_macro && func_macro->native == NULL && func_macro->rest_param == NULL &&
+      func_macro->arity == n && func_macro->n_of_bodies > 0 && o->inline_depth < OPT_INLINE_MAX_DEPTH && !profiling)
+  {
+    const node_t **bodies = func_macro_body_nodes(func_macro);
+    if (opt_count_nodes(func_macro->n_of_bodies, bodies, OPT_INLINE_MAX_NODES + 1) <= OPT_INLINE_MAX_NODES &&
+        !opt_any_calls(func_macro->n_of_bodies, bodies, func_macro->name))
+      return opt_inline(o, func_macro, node->call.args, args);
+  }
+  node_t *call = new_node(node->kind);
+  call->call = node->call;
+  call->call.args = args;
+  call->call.expansion = NULL;
+  call->call.expansion_epoch = 0;
+  call->call.cache = (call_cache_t){.epoch = -1};
+  return call;
+}
+
+const node_t *opt_node(optimizer_t *o, const node_t *node)
+{
+  switch (node->kind)
+  {
+  case node_constant:
+  case node_unbound:
+  case node_malformed:
+  case node_definition:
+    return node;
+  case node_variable:
+  {
+    const opt_frame_t *frame = &o->frames[o->n_frames - 1 - node->variable.depth];
+    const opt_slot_t slot = frame->slots[node->variable.index];
+    return slot.is_constant ? opt_constant(slot.constant) : opt_variable(o, slot.level, slot.index);
+  }
+  case node_if:
+  {
+    const node_t *cond = opt_node(o, node->if_.cond);
+    if (cond->kind == node_constant)
+      return opt_node(o, is_false(cond->constant) ? node->if_.otherwise : node->if_.then);
+    node_t *if_ = new_node(node_if);
+    if_->if_.cond = cond;
+    if_->if_.then = opt_node(o, node->if_.then);
+    if_->if_.otherwise = opt_node(o, node->if_.otherwise);
+    return if_;
+  }
+  case node_let:
+  case node_loop:
+  {
+    const int n = node->let_loop.n_bindings;
+    opt_push_frame(o, false, n);
+    const node_t **inits = new_nodes(n);
+    bool all_constant = true;
+    for (int i = 0; i < n; i++)
+    {
+      inits[i] = opt_node(o, node->let_loop.inits[i]);
+      // loop variables change with each cont
+      if (node->kind == node_let && inits[i]->kind == node_constant)
+        o->frames[o->n_frames - 1].slots[i] = (opt_slot_t){.is_constant = true, .constant = inits[i]->constant};
+      else
+        all_constant = false;
+    }
+    if (node->kind == node_let && all_constant && node->let_loop.n_bodies == 1 && !opt_any_calls(1, node->let_loop.bodies, NULL))
+    {
+      // the body reads the constants and the frame goes away
+      opt_frame_t frame = o->frames[o->n_frames - 1];
+      opt_pop_frame(o);
+      opt_push_frame(o, true, 0);
+      o->frames[o->n_frames - 1].slots = frame.slots;
+      o->depends = true;
+      const node_t *body = opt_node(o, node->let_loop.bodies[0]);
+      opt_pop_frame(o);
+      return body;
+    }
+    node_t *let_loop = new_node(node->kind);
+    let_loop->let_loop.n_bindings = n;
+    let_loop->let_loop.inits = inits;
+    let_loop->let_loop.n_bodies = node->let_loop.n_bodies;
+    let_loop->let_loop.bodies = opt_nodes(o, node->let_loop.n_bodies, node->let_loop.bodies);
+    opt_pop_frame(o);
+    return let_loop;
+  }
+  case node_cont:
+  {
+    node_t *cont = new_node(node_cont);
+    cont->cont = node->cont;
+    cont->cont.args = opt_nodes(o, node->cont.n_args, node->cont.args);
+    if (node->cont.depth >= 0)
+      cont->cont.depth = o->levels - 1 - o->frames[o->n_frames - 1 - node->cont.depth].level;
+    return cont;
+  }
+  case node_builtin_call:
+  case node_call:
+  case node_macro_call:
+    return opt_call(o, node);
+  }
+  return node;
+}
+
+// the nodes funcs run, body_nodes optimized for the current definitions, macros and natives run body_nodes
+const node_t **func_macro_run_nodes(const FuncMacro *func_macro)
+{
+  const node_t **body_nodes = func_macro_body_nodes(func_macro);
+  if (!optimize_funcs || func_macro->is_macro || func_macro->n_of_bodies == 0)
+    return body_nodes;
+  if (func_macro->optimized_nodes != NULL && (!func_macro->optimized_depends || func_macro->optimized_epoch == interp->definition_epoch))
+    return func_macro->optimized_nodes;
+  arena_t *prev_node_arena = interp->node_arena;
+  interp->node_arena = &interp->permanent_arena;
+  optimizer_t o = {0};
+  opt_push_frame(&o, false, func_macro->arity + (func_macro->rest_param == NULL ? 0 : 1));
+  FuncMacro *mutable_func_macro = (FuncMacro *)func_macro;
+  mutable_func_macro->optimized_nodes = opt_nodes(&o, func_macro->n_of_bodies, body_nodes);
+  mutable_func_macro->optimized_depends = o.depends;
+  mutable_func_macro->optimized_epoch = interp->definition_epoch;
+  free(o.frames);
+  interp->node_arena = prev_node_arena;
+  return func_macro->optimized_nodes;
+}
+
+form_t apply_builtin(const char *name, const built_in_func_t *builtin, int number_of_given_args, form_t *args)
+{
+  if (!profiling)
+    return invoke_builtin(name, builtin, number_of_given_args, args);
+  profile_enter(profile_builtin_entry(builtin));
+  const form_t result = invoke_builtin(name, builtin, number_of_given_args, args);
+  profile_exit();
+  return result;
+}
+
+form_t call_builtin(const char *name, const built_in_func_t *builtin, int number_of_given_args, const node_t **args, const Env_t *env)
+{
+  if (builtin->variadic)
+  {
+    form_t *arg_values = value_stack_push(number_of_given_args);
+    for (int i = 0; i < number_of_given_args; i++)
+      arg_values[i] = eval(args[i], env);
+    const form_t res = apply_builtin(name, builtin, number_of_given_args, arg_values);
+    value_stack_pop(number_of_given_args);
+    return res;
+  }
+  program_assert(builtin->parameters == number_of_given_args, "builtin arity mismatch");
+  if (number_of_given_args > 3)
+    program_error("Error: unknown builtin function %.*s with arity %d\n", symbol_length(name), name, number_of_given_args);
+  // builtins of fixed arity do not allocate on the heap, earlier values only need rooting while evaluating later arguments can collect
+  bool needs_roots = false;
+  for (int i = 1; i < number_of_given_args; i++)
+    needs_roots |= args[i]->kind != node_constant && args[i]->kind != node_variable;
+  form_t arg_values[3] = {0};
+  if (needs_roots)
+    gc_push_roots(arg_values, number_of_given_args);
+  for (int i = 0; i < number_of_given_args; i++)
+    arg_values[i] = eval(args[i], env);
+  if (needs_roots)
+    gc_pop_roots();
+  return apply_builtin(name, builtin, number_of_given_args, arg_values);
+}
+
+void assert_func_macro_arity(const FuncMacro *func_macro, int number_of_given_args)
+{
+  if (func_macro->rest_param == NULL)
+    program_assert(number_of_given_args == func_macro->arity, "func/macro call arity mismatch");
+  else
+    program_assert(number_of_given_args >= func_macro->arity, "func/macro call arity mismatch");
+}
+
+// evaluates the bodies of func_macro in a frame holding the parameter values
+form_t apply_func_macro(const FuncMacro *func_macro, form_t *arg_values)
+{
+  const Env_t new_env = {.parent = NULL, .values = arg_values};
+  interp->eval_depth++;
+  check_eval_depth();
+  if (profiling)
+    profile_enter(profile_func_entry(func_macro->name));
+  const form_t result = func_macro->native != NULL
+                           ? func_macro->native(arg_values)
+                           : eval_bodies(func_macro->n_of_bodies, func_macro_run_nodes(func_macro), &new_env);
+  if (profiling)
+    profile_exit();
+  interp->eval_depth--;
+  return result;
+}
+
+form_t call_func(const FuncMacro *func_macro, int number_of_given_args, const node_t **args, const Env_t *env)
+{
+  assert_func_macro_arity(func_macro, number_of_given_args);
+  const int number_of_regular_params = func_macro->arity;
+  const bool has_rest = func_macro->rest_param != NULL;
+  // arguments are evaluated straight into the parameter slots of the frame of the call
+  form_t *arg_values = value_stack_push(number_of_regular_params + 1);
+  int i = 0;
+  for (; i < number_of_regular_params; i++)
+    arg_values[i] = eval(args[i], env);
+  if (has_rest)
+  {
+    // rest arguments are evaluated straight into the list bound to the rest parameter, it is rooted by arg_values meanwhile
+    const int number_of_rest_args = number_of_given_args - i;
+    form_t rest = unit;
+    if (number_of_rest_args > 0)
+    {
+      form_t *rest_forms = gc_alloc_backing(number_of_rest_args, number_of_rest_args);
+      memset(rest_forms, 0, sizeof(form_t) * number_of_rest_args);
+      rest = (form_t){.tag = form_list, .len = number_of_rest_args, .forms = rest_forms};
+      arg_values[number_of_regular_params] = rest;
+      for (int j = 0; j < number_of_rest_args; j++)
+        rest_forms[j] = eval(args[i + j], env);
+    }
+    arg_values[number_of_regular_params] = rest;
+  }
+  const form_t result = apply_func_macro(func_macro, arg_values);
+  value_stack_pop(number_of_regular_params + 1);
+  return result;
+}
+
+form_t expand_macro(const FuncMacro *func_macro, form_t form)
+{
+  const int number_of_given_args = form.len - 1;
+  assert_func_macro_arity(func_macro, number_of_given_args);
+  const int number_of_regular_params = func_macro->arity;
+  form_t *arg_values = value_stack_push(number_of_regular_params + 1);
+  for (int i = 0; i < number_of_regular_params; i++)
+    arg_values[i] = form_items(form)[i + 1];
+  if (func_macro->rest_param != NULL)
+    arg_values[number_of_regular_params] = slice(form, number_of_regular_params + 1, form.len);
+  const form_t result = apply_func_macro(func_macro, arg_values);
+  value_stack_pop(number_of_regular_params + 1);
+  return result;
+}
+
+// expands a macro call and caches the expansion, compiled in the scope and region of the call site
+const node_t *expand_call_site(const node_t *node, const FuncMacro *func_macro)
+{
+  node_t *mutable_node = (node_t *)node;
+  form_t expanded = expand_macro(func_macro, node->call.form);
+  arena_t *prev_node_arena = interp->node_arena;
+  interp->node_arena = node->call.arena;
+  // the expansion may be made of heap lists, nodes only point into arenas
+  expanded = promote_form(interp->node_arena, expanded);
+  mutable_node->call.expansion = compile(expanded, node->call.scope);
+  mutable_node->call.expansion_epoch = interp->definition_epoch;
+  interp->call_site_expansions++;
+  interp->node_arena = prev_node_arena;
+  return node->call.expansion;
+}
+
+form_t eval_call(const node_t *node, const Env_t *env)
+{
+  if (node->call.expansion != NULL && node->call.expansion_epoch == interp->definition_epoch)
+    return eval(node->call.expansion, env);
+  const char *name = node->call.name;
+  const int number_of_given_args = node->call.n_args;
+  const built_in_func_t *builtin;
+  const FuncMacro *func_macro = resolve_call(&((node_t *)node)->call.cache, name, &builtin);
+  if (func_macro == NULL)
+  {
+    if (builtin == NULL)
+      program_error("Error: unknown function %.*s\n", symbol_length(name), name);
+    return call_builtin(name, builtin, number_of_given_args, node->call.args, env);
+  }
+  if (func_macro->is_macro)
+    return eval(expand_call_site(node, func_macro), env);
+  if (node->call.args == NULL && number_of_given_args > 0)
+  {
+    // compiled as a macro call but the name now refers to a func
+    node_t *mutable_node = (node_t *)node;
+    arena_t *prev_node_arena = interp->node_arena;
+    interp->node_arena = node->call.arena;
+    mutable_node->call.args = compile_all(number_of_given_args, form_items(node->call.form) + 1, node->call.scope);
+    interp->node_arena = prev_node_arena;
+  }
+  return call_func(func_macro, number_of_given_args, node->call.args, env);
+}
+
+// what the definitions of an interpreter were before a server request first defined something, restored after the request
+// the env and the funcs in it are only copied when a request writes them
+typedef struct definitions_checkpoint
+{
+  bool taken;
+  arena_mark_t permanent;
+  FuncMacroBinding *bindings;
+  int cap;
+  int len;
+  int shadowed_builtins;
+  // definition_epoch then, and the highest one used since the server started
+  int epoch;
+  int last_epoch;
+  // the funcs bound then and their lazily filled bodies, chunks and optimized nodes, which may be replaced by ones in the released region
+  FuncMacro **func_macros;
+  FuncMacro *saved;
+  int n_func_macros;
+} definitions_checkpoint_t;
+
+void checkpoint_definitions(definitions_checkpoint_t *checkpoint)
+{
+  const FuncMacroEnv *env = &interp->func_macro_env;
+  checkpoint->taken = true;
+  checkpoint->permanent = arena_mark(&interp->permanent_arena);
+  checkpoint->cap = env->cap;
+  checkpoint->len = env->len;
+  checkpoint->shadowed_builtins = interp->shadowed_builtins;
+  // caches filled from now on get an epoch that is never current again after the restore
+  checkpoint->epoch = interp->definition_epoch;
+  if (checkpoint->last_epoch < interp->definition_epoch)
+    checkpoint->last_epoch = interp->definition_epoch;
+  interp->definition_epoch = ++checkpoint->last_epoch;
+  checkpoint->bindings = realloc(checkpoint->bindings, sizeof(FuncMacroBinding) * env->cap);
+  memcpy(checkpoint->bindings, env->bindings, sizeof(FuncMacroBinding) * env->cap);
+  checkpoint->func_macros = realloc(checkpoint->func_macros, sizeof(FuncMacro *) * env->len);
+  checkpoint->saved = realloc(checkpoint->saved, sizeof(FuncMacro) * env->len);
+  checkpoint->n_func_macros = 0;
+  for (int i = 0; i < env->cap; i++)
+    if (env->bindings[i].func_macro != NULL)
+    {
+      FuncMacro *func_macro = (FuncMacro *)env->bindings[i].func_macro;
+      checkpoint->func_macros[checkpoint->n_func_macros] = func_macro;
+      memcpy(&checkpoint->saved[checkpoint->n_func_macros++], func_macro, sizeof(FuncMacro));
+    }
+}
+
+// undoes the definitions made since the checkpoint was taken, if it was
+void restore_definitions(definitions_checkpoint_t *checkpoint)
+{
+  if (!checkpoint->taken)
+    return;
+  checkpoint->taken = false;
+  FuncMacroEnv *env = &interp->func_macro_env;
+  if (env->cap != checkpoint->cap)
+  {
+    free(env->bindings);
+    env->bindings = malloc(sizeof(FuncMacroBinding) * checkpoint->cap);
+    env->cap = checkpoint->cap;
+  }
+  memcpy(env->bindings, checkpoint->bindings, sizeof(FuncMacroBinding) * checkpoint->cap);
+  env->len = checkpoint->len;
+  interp->shadowed_builtins = checkpoint->shadowed_builtins;
+  for (int i = 0; i < checkpoint->n_func_macros; i++)
+    memcpy(checkpoint->func_macros[i], &checkpoint->saved[i], sizeof(FuncMacro));
+  arena_rollback(&interp->permanent_arena, checkpoint->permanent);
+  // call site caches, macro expansions and bytecode filled since point into the released region but are stale at the old epoch
+  if (checkpoint->last_epoch < interp->definition_epoch)
+    checkpoint->last_epoch = interp->definition_epoch;
+  interp->definition_epoch = checkpoint->epoch;
+}
+
+form_t eval_definition(const node_t *node)
+{
+  if (interp->checkpoint != NULL && !interp->checkpoint->taken)
+    checkpoint_definitions(interp->checkpoint);
+  // the definition escapes the current top-level form so it is promoted to the permanent region
+  arena_t *prev_node_arena = interp->node_arena;
+  interp->node_arena = &interp->permanent_arena;
+  const int arity = node->definition.arity;
+  const char *rest_param = node->definition.rest_param;
+  const int number_of_params = arity + (rest_param == NULL ? 0 : 1);
+  const char **parameters = arena_alloc(&interp->permanent_arena, (arity + 1) * sizeof(char *));
+  memcpy(parameters, node->definition.parameters, (arity + 1) * sizeof(char *));
+  const int n_of_bodies = node->definition.n_of_bodies;
+  form_t *bodies = alloc_forms(&interp->permanent_arena, n_of_bodies);
+  for (int i = 0; i < n_of_bodies; i++)
+    bodies[i] = promote_form(&interp->permanent_arena, node->definition.bodies[i]);
+  const Scope_t *scope = new_scope(NULL, number_of_params, parameters);
+  FuncMacro func_macro = {
+      .name = node->definition.name,
+      .is_macro = node->definition.is_macro,
+      .arity = arity,
+      .parameters = parameters,
+      .rest_param = rest_param,
+      .n_of_bodies = n_of_bodies,
+      .bodies = bodies,
+      .body_nodes = compile_all(n_of_bodies, bodies, scope),
+      .chunk = NULL,
+  };
+  interp->node_arena = prev_node_arena;
+  FuncMacro *stored_func_macro = arena_alloc(&interp->permanent_arena, sizeof(FuncMacro));
+  memcpy(stored_func_macro, &func_macro, sizeof(FuncMacro));
+  insert_func_macro_binding(node->definition.name, stored_func_macro);
+  func_macro_run_nodes(stored_func_macro);
+  {
+    const FuncMacro *test_func_macro = get_func_macro(node->definition.name);
+    assert(test_func_macro != NULL && "func/macro not found");
+    assert(test_func_macro->arity == arity && "func/macro arity mismatch");
+  }
+  return unit;
+}
+
+form_t eval(const node_t *node, const Env_t *env)
+{
+  switch (node->kind)
+  {
+  case node_constant:
+    return node->constant;
+  case node_variable:
+  {
+    for (int depth = node->variable.depth; depth > 0; depth--)
+      env = env->parent;
+    return env->values[node->variable.index];
+  }
+  case node_unbound:
+    // to do proper error handling
+    program_error("Error: word not found in env %.*s\n", symbol_length(node->unbound), node->unbound);
+  case node_malformed:
+    program_error("Error: %s\n", node->malformed);
+  case node_if:
+  {
+    const form_t cond = eval(node->if_.cond, env);
+    return eval(is_false(cond) ? node->if_.otherwise : node->if_.then, env);
+  }
+  case node_let:
+  case node_loop:
+  {
+    const int number_of_bindings = node->let_loop.n_bindings;
+    form_t *values = value_stack_push(number_of_bindings);
+    const Env_t new_env = {.parent = env, .values = values};
+    for (int i = 0; i < number_of_bindings; i++)
+      values[i] = eval(node->let_loop.inits[i], &new_env);
+    if (node->kind == node_let)
+    {
+      const form_t result = eval_bodies(node->let_loop.n_bodies, node->let_loop.bodies, &new_env);
+      value_stack_pop(number_of_bindings);
+      return result;
+    }
+    while (true)
+    {
+      const form_t result = eval_bodies(node->let_loop.n_bodies, node->let_loop.bodies, &new_env);
+      // cont already stored the values for the next iteration
+      if (result.tag == form_continue)
+        continue;
+      value_stack_pop(number_of_bindings);
+      return result;
+    }
+  }
+  case node_cont:
+  {
+    if (node->cont.depth < 0)
+      program_error("Error: cont outside of a loop\n");
+    const int n = node->cont.n_args;
+    program_assert(n == node->cont.n_bindings, "loop bindings mismatch");
+    // all arguments see the values of the current iteration
+    form_t new_values[n + 1];
+    for (int i = 0; i < n; i++)
+      new_values[i].tag = 0;
+    gc_push_roots(new_values, n);
+    for (int i = 0; i < n; i++)
+      new_values[i] = eval(node->cont.args[i], env);
+    gc_pop_roots();
+    const Env_t *loop_env = env;
+    for (int depth = node->cont.depth; depth > 0; depth--)
+      loop_env = loop_env->parent;
+    for (int i = 0; i < n; i++)
+      loop_env->values[i] = new_values[i];
+    return continue_signal;
+  }
+  case node_builtin_call:
+    // a func may shadow the builtin once any builtin is shadowed, the call site cache finds out
+    if (interp->shadowed_builtins == 0)
+      return call_builtin(node->call.name, node->call.builtin, node->call.n_args, node->call.args, env);
+    return eval_call(node, env);
+  case node_call:
+  case node_macro_call:
+    return eval_call(node, env);
+  case node_definition:
+    return eval_definition(node);
+  }
+  flush_output();
+  printf("eval Error: unknown node kind %d\n", node->kind);
+  exit(1);
+}
+
+// bytecode engine, func bodies are compiled from their nodes into code for a register machine
+// registers of a call are a window of vm_registers starting at the first argument of the call
+typedef enum
+{
+  op_const = 1,
+  op_move,
+  op_unbound,
+  op_jump,
+  op_jump_if_false,
+  op_add,
+  op_sub,
+  op_bit_and,
+  op_bit_or,
+  op_bit_xor,
+  op_eq,
+  op_lt,
+  op_le,
+  op_ge,
+  op_gt,
+  op_builtin,
+  op_call,
+  // a call in tail position of a func, the callee reuses the frame of the caller
+  op_tailcall,
+  op_return,
+} vm_op;
+
+// a = destination register, b and c = operand registers, constants or jump targets, n = number of arguments
+typedef struct
+{
+  uint8_t op;
+  uint8_t n;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+} vm_instr_t;
+
+typedef struct vm_chunk
+{
+  int n_regs;
+  // definition_epoch when compiled, builtins and macro expansions may be stale after it
+  int epoch;
+  const vm_instr_t *code;
+  const form_t *constants;
+  const built_in_func_t **builtins;
+  // inline caches of the calls, indexed like the constant holding their name
+  call_cache_t *call_caches;
+} vm_chunk_t;
+
+// marks a func the vm cannot compile, it runs on eval instead, until definition_epoch moves past not_compilable_epoch
+// or eval expands more macro call sites
+const vm_chunk_t vm_not_compilable = {.n_regs = 0, .epoch = -1, .code = NULL};
+
+#define VM_MAX_REGS 65535
+#define VM_MAX_CODE 65535
+// initial sizes of the register and frame stacks, they grow on the heap up to max_depth frames
+#define VM_INITIAL_REGISTERS (1 << 16)
+#define VM_INITIAL_FRAMES (1 << 10)
+
+typedef struct
+{
+  vm_instr_t *code;
+  int len;
+  int cap;
+  form_t *constants;
+  int n_constants;
+  int cap_constants;
+  const built_in_func_t **builtins;
+  int n_builtins;
+  int cap_builtins;
+  // first register of each let/loop/parameter frame, innermost last
+  int *frames;
+  int n_frames;
+  int cap_frames;
+  int top;
+  int max_regs;
+  // a call compiled into the result register is in tail position
+  int result_reg;
+  bool failed;
+} vm_compiler_t;
+
+// target of a cont in tail position
+typedef struct
+{
+  int first_reg;
+  int n_bindings;
+  int start;
+} vm_loop_t;
+
+int vm_emit(vm_compiler_t *c, vm_op op, int n, int a, int b, int cc)
+{
+  if (c->len == c->cap)
+  {
+    c->cap = c->cap == 0 ? 64 : c->cap * 2;
+    c->code = realloc(c->code, sizeof(vm_instr_t) * c->cap);
+  }
+  if (c->len >= VM_MAX_CODE || a > VM_MAX_REGS || b > VM_MAX_REGS || cc > VM_MAX_REGS || n > UINT8_MAX)
+    c->failed = true;
+  c->code[c->len] = (vm_instr_t){.op = op, .n = n, .a = a, .b = b, .c = cc};
+  return c->len++;
+}
+
+int vm_constant(vm_compiler_t *c, form_t form)
+{
+  if (c->n_constants == c->cap_constants)
+  {
+    c->cap_constants = c->cap_constants == 0 ? 16 : c->cap_constants * 2;
+    c->constants = realloc(c->constants, sizeof(form_t) * c->cap_constants);
+  }
+  c->constants[c->n_constants] = form;
+  return c->n_constants++;
+}
+
+int vm_builtin(vm_compiler_t *c, const built_in_func_t *builtin)
+{
+  if (c->n_builtins == c->cap_builtins)
+  {
+    c->cap_builtins = c->cap_builtins == 0 ? 16 : c->cap_builtins * 2;
+    c->builtins = realloc(c->builtins, sizeof(built_in_func_t *) * c->cap_builtins);
+  }
+  c->builtins[c->n_builtins] = builtin;
+  return c->n_builtins++;
+}
+
+int vm_alloc_regs(vm_compiler_t *c, int n)
+{
+  const int first = c->top;
+  c->top += n;
+  if (c->top > c->max_regs)
+    c->max_regs = c->top;
+  return first;
+}
+
+void vm_push_frame(vm_compiler_t *c, int first_reg)
+{
+  if (c->n_frames == c->cap_frames)
+  {
+    c->cap_frames = c->cap_frames == 0 ? 8 : c->cap_frames * 2;
+    c->frames = realloc(c->frames, sizeof(int) * c->cap_frames);
+  }
+  c->frames[c->n_frames++] = first_reg;
+}
+
+// the builtins with a dedicated instruction, in vm_op order from op_add
+static const char *vm_op_builtin_names[] = {"add", "sub", "bit-and", "bit-or", "bit-xor", "eq", "lt", "le", "ge", "gt"};
+static const char *vm_op_builtin_symbols[op_gt - op_add + 1];
+
+void init_vm_op_symbols()
+{
+  for (int i = 0; i <= op_gt - op_add; i++)
+    vm_op_builtin_symbols[i] = intern(vm_op_builtin_names[i], strlen(vm_op_builtin_names[i]));
+}
+
+// the instruction for a builtin, or 0 if it has none
+vm_op vm_op_for_builtin(const char *name)
+{
+  // profiled builtins go through op_builtin so each call is counted
+  if (profiling)
+    return 0;
+  for (int i = 0; i <= op_gt - op_add; i++)
+    if (name == vm_op_builtin_symbols[i])
+      return op_add + i;
+  return 0;
+}
+
+void vm_compile_node(vm_compiler_t *c, const node_t *node, int dst, const vm_loop_t *tail_loop);
+
+// returns a register holding the value of node, variables are used in place
+int vm_compile_operand(vm_compiler_t *c, const node_t *node)
+{
+  if (node->kind == node_variable && node->variable.depth < c->n_frames)
+    return c->frames[c->n_frames - 1 - node->variable.depth] + node->variable.index;
+  const int reg = vm_alloc_regs(c, 1);
+  vm_compile_node(c, node, reg, NULL);
+  return reg;
+}
+
+void vm_compile_bodies(vm_compiler_t *c, int n, const node_t **bodies, int dst, const vm_loop_t *tail_loop)
+{
+  if (n == 0)
+  {
+    vm_emit(c, op_const, 0, dst, vm_constant(c, unit), 0);
+    return;
+  }
+  for (int i = 0; i < n - 1; i++)
+  {
+    const int saved_top = c->top;
+    vm_compile_node(c, bodies[i], vm_alloc_regs(c, 1), NULL);
+    c->top = saved_top;
+  }
+  vm_compile_node(c, bodies[n - 1], dst, tail_loop);
+}
+
+// evaluates the arguments into consecutive registers, returns the first
+// one register more than the arguments like aot_compile_args, a callee with a rest parameter and no rest arguments binds it there
+int vm_compile_args(vm_compiler_t *c, int n, const node_t **args)
+{
+  const int first = vm_alloc_regs(c, n + 1);
+  for (int i = 0; i < n; i++)
+    vm_compile_node(c, args[i], first + i, NULL);
+  return first;
+}
+
+void vm_compile_call(vm_compiler_t *c, const node_t *node, int dst, const vm_loop_t *tail_loop)
+{
+  const int n = node->call.n_args;
+  const FuncMacro *func_macro = get_func_macro(node->call.name);
+  if (func_macro != NULL && func_macro->is_macro)
+  {
+    // compile the cached expansion in place, the chunk is recompiled when the epoch moves on
+    // a call eval has not expanded yet may sit in a branch that never runs, expanding it here could abort or log
+    if (node->call.expansion == NULL || node->call.expansion_epoch != interp->definition_epoch)
+    {
+      c->failed = true;
+      return;
+    }
+    vm_compile_node(c, node->call.expansion, dst, tail_loop);
+    return;
+  }
+  if (func_macro == NULL && node->kind == node_builtin_call)
+  {
+    const built_in_func_t *builtin = node->call.builtin;
+    const vm_op op = vm_op_for_builtin(node->call.name);
+    if (op != 0 && n == 2)
+    {
+      const int saved_top = c->top;
+      const int a = vm_compile_operand(c, node->call.args[0]);
+      const int b = vm_compile_operand(c, node->call.args[1]);
+      vm_emit(c, op, 0, dst, a, b);
+      c->top = saved_top;
+      return;
+    }
+    const int saved_top = c->top;
+    const int first = vm_compile_args(c, n, node->call.args);
+    vm_emit(c, op_builtin, n, dst, first, vm_builtin(c, builtin));
+    c->top = saved_top;
+    return;
+  }
+  if (node->call.args == NULL && n > 0)
+  {
+    c->failed = true;
+    return;
+  }
+  const int saved_top = c->top;
+  const int first = vm_compile_args(c, n, node->call.args);
+  const vm_op op = dst == c->result_reg ? op_tailcall : op_call;
+  vm_emit(c, op, n, dst, first, vm_constant(c, (form_t){.tag = form_word, .len = 0, .word = node->call.name}));
+  c->top = saved_top;
+}
+
+void vm_compile_node(vm_compiler_t *c, const node_t *node, int dst, const vm_loop_t *tail_loop)
+{
+  if (c->failed)
+    return;
+  switch (node->kind)
+  {
+  case node_constant:
+    vm_emit(c, op_const, 0, dst, vm_constant(c, node->constant), 0);
+    return;
+  case node_variable:
+    if (node->variable.depth >= c->n_frames)
+    {
+      c->failed = true;
+      return;
+    }
+    vm_emit(c, op_move, 0, dst, c->frames[c->n_frames - 1 - node->variable.depth] + node->variable.index, 0);
+    return;
+  case node_unbound:
+    vm_emit(c, op_unbound, 0, 0, vm_constant(c, (form_t){.tag = form_word, .len = 0, .word = node->unbound}), 0);
+    return;
+  case node_if:
+  {
+    const int saved_top = c->top;
+    const int cond = vm_compile_operand(c, node->if_.cond);
+    c->top = saved_top;
+    const int jump_to_else = vm_emit(c, op_jump_if_false, 0, cond, 0, 0);
+    vm_compile_node(c, node->if_.then, dst, tail_loop);
+    const int jump_to_end = vm_emit(c, op_jump, 0, 0, 0, 0);
+    c->code[jump_to_else].b = c->len;
+    vm_compile_node(c, node->if_.otherwise, dst, tail_loop);
+    c->code[jump_to_end].b = c->len;
+    return;
+  }
+  case node_let:
+  case node_loop:
+  {
+    const int saved_top = c->top;
+    const int n = node->let_loop.n_bindings;
+    const int first = vm_alloc_regs(c, n);
+    vm_push_frame(c, first);
+    for (int i = 0; i < n; i++)
+      vm_compile_node(c, node->let_loop.inits[i], first + i, NULL);
+    if (node->kind == node_let)
+      vm_compile_bodies(c, node->let_loop.n_bodies, node->let_loop.bodies, dst, tail_loop);
+    else
+    {
+      const vm_loop_t loop = {.first_reg = first, .n_bindings = n, .start = c->len};
+      vm_compile_bodies(c, node->let_loop.n_bodies, node->let_loop.bodies, dst, &loop);
+    }
+    c->n_frames--;
+    c->top = saved_top;
+    return;
+  }
+  case node_cont:
+  {
+    // only a cont in tail position of a loop body is a jump, anything else runs on eval
+    if (tail_loop == NULL || tail_loop->n_bindings != node->cont.n_args)
+    {
+      c->failed = true;
+      return;
+    }
+    const int saved_top = c->top;
+    const int n = node->cont.n_args;
+    const int first = vm_compile_args(c, n, node->cont.args);
+    for (int i = 0; i < n; i++)
+      vm_emit(c, op_move, 0, tail_loop->first_reg + i, first + i, 0);
+    vm_emit(c, op_jump, 0, 0, tail_loop->start, 0);
+    c->top = saved_top;
+    return;
+  }
+  case node_builtin_call:
+  case node_call:
+  case node_macro_call:
+    vm_compile_call(c, node, dst, tail_loop);
+    return;
+  case node_malformed:
+  case node_definition:
+    c->failed = true;
+    return;
+  }
+  c->failed = true;
+}
+
+// compiles bodies in a frame of n_params parameter registers, returns NULL if the vm cannot run them
+const vm_chunk_t *vm_compile(int n_params, int n_bodies, const node_t **bodies, arena_t *arena)
+{
+  vm_compiler_t c = {0};
+  if (n_params > 0)
+    vm_push_frame(&c, vm_alloc_regs(&c, n_params));
+  const int result = vm_alloc_regs(&c, 1);
+  c.result_reg = result;
+  vm_compile_bodies(&c, n_bodies, bodies, result, NULL);
+  vm_emit(&c, op_return, 0, result, 0, 0);
+  vm_chunk_t *chunk = NULL;
+  if (!c.failed && c.max_regs <= VM_MAX_REGS)
+  {
+    chunk = arena_alloc(arena, sizeof(vm_chunk_t));
+    vm_instr_t *code = arena_alloc(arena, sizeof(vm_instr_t) * c.len);
+    memcpy(code, c.code, sizeof(vm_instr_t) * c.len);
+    form_t *constants = alloc_forms(arena, c.n_constants);
+    if (c.n_constants > 0)
+      memcpy(constants, c.constants, sizeof(form_t) * c.n_constants);
+    const built_in_func_t **builtins = c.n_builtins == 0 ? NULL : arena_alloc(arena, sizeof(built_in_func_t *) * c.n_builtins);
+    if (c.n_builtins > 0)
+      memcpy(builtins, c.builtins, sizeof(built_in_func_t *) * c.n_builtins);
+    call_cache_t *call_caches = c.n_constants == 0 ? NULL : arena_alloc(arena, sizeof(call_cache_t) * c.n_constants);
+    for (int i = 0; i < c.n_constants; i++)
+      call_caches[i] = (call_cache_t){.epoch = -1};
+    *chunk = (vm_chunk_t){.n_regs = c.max_regs, .epoch = interp->definition_epoch, .code = code, .constants = constants, .builtins = builtins, .call_caches = call_caches};
+  }
+  free(c.code);
+  free(c.constants);
+  free(c.builtins);
+  free(c.frames);
+  return chunk;
+}
+
+// the chunk of a func, compiled on first use and again when definitions changed since
+const vm_chunk_t *vm_chunk_for(const FuncMacro *func_macro)
+{
+  const vm_chunk_t *chunk = func_macro->chunk;
+  if (chunk != NULL && chunk->epoch == interp->definition_epoch)
+    return chunk;
+  // natives are called like funcs eval runs
+  if (func_macro->native != NULL)
+    return &vm_not_compilable;
+  if (chunk == &vm_not_compilable && interp->not_compilable_epoch == interp->definition_epoch &&
+      interp->not_compilable_expansions == interp->call_site_expansions)
+    return chunk;
+  const int n_params = func_macro->arity + (func_macro->rest_param == NULL ? 0 : 1);
+  chunk = vm_compile(n_params, func_macro->n_of_bodies, func_macro_run_nodes(func_macro), &interp->permanent_arena);
+  if (chunk == NULL)
+  {
+    interp->not_compilable_epoch = interp->definition_epoch;
+    interp->not_compilable_expansions = interp->call_site_expansions;
+    chunk = &vm_not_compilable;
+  }
+  ((FuncMacro *)func_macro)->chunk = chunk;
+  return chunk;
+}
+
+typedef struct vm_frame
+{
+  const vm_chunk_t *chunk;
+  const vm_instr_t *pc;
+  // offset of the first register of the frame in vm_registers which moves when it grows
+  size_t regs;
+  // vm_registers_live before the call, restored when it returns
+  size_t live;
+  int result_reg;
+} vm_frame_t;
+
+void vm_reserve_registers(size_t n)
+{
+  if (n <= interp->vm_registers_cap)
+    return;
+  size_t cap = interp->vm_registers_cap == 0 ? VM_INITIAL_REGISTERS : interp->vm_registers_cap;
+  while (cap < n)
+    cap *= 2;
+  interp->vm_registers = realloc(interp->vm_registers, sizeof(form_t) * cap);
+  if (interp->vm_registers == NULL)
+  {
+    flush_output();
+    printf("Error: out of memory for vm registers\n");
+    exit(1);
+  }
+  interp->vm_registers_cap = cap;
+}
+
+void vm_reserve_frames(int n)
+{
+  if (n > max_depth)
+    program_error("Error: call depth exceeds %d, see --max-depth\n", max_depth);
+  if (n <= interp->vm_frames_cap)
+    return;
+  interp->vm_frames_cap = interp->vm_frames_cap == 0 ? VM_INITIAL_FRAMES : interp->vm_frames_cap * 2;
+  interp->vm_frames = realloc(interp->vm_frames, sizeof(vm_frame_t) * interp->vm_frames_cap);
+}
+
+form_t vm_execute(const vm_chunk_t *chunk)
+{
+  const vm_instr_t *pc = chunk->code;
+  vm_reserve_registers(chunk->n_regs);
+  form_t *regs = interp->vm_registers;
+  memset(regs, 0, sizeof(form_t) * chunk->n_regs);
+  interp->vm_registers_live = chunk->n_regs;
+  int n_frames = 0;
+  while (true)
+  {
+    const vm_instr_t instr = *pc++;
+    switch (instr.op)
+    {
+    case op_const:
+      regs[instr.a] = chunk->constants[instr.b];
+      break;
+    case op_move:
+      regs[instr.a] = regs[instr.b];
+      break;
+    case op_unbound:
+      program_error("Error: word not found in env %.*s\n", symbol_length(chunk->constants[instr.b].word), chunk->constants[instr.b].word);
+    case op_jump:
+      pc = chunk->code + instr.b;
+      break;
+    case op_jump_if_false:
+      if (is_false(regs[instr.a]))
+        pc = chunk->code + instr.b;
+      break;
+#define VM_INT_OP(name, op, bi)                                          \
+  case name:                                                             \
+  {                                                                      \
+    const form_t a = regs[instr.b], b = regs[instr.c];                   \
+    regs[instr.a] = a.tag == form_int && b.tag == form_int               \
+                        ? word_from_int(a.number op b.number)            \
+                        : bi(a, b);                                      \
+    break;                                                               \
+  }
+#define VM_INT_CMP(name, op, bi)                                         \
+  case name:                                                             \
+  {                                                                      \
+    const form_t a = regs[instr.b], b = regs[instr.c];                   \
+    regs[instr.a] = a.tag == form_int && b.tag == form_int               \
+                        ? (a.number op b.number ? one : zero)            \
+                        : bi(a, b);                                      \
+    break;                                                               \
+  }
+      VM_INT_OP(op_add, +, bi_add)
+      VM_INT_OP(op_sub, -, bi_sub)
+      VM_INT_OP(op_bit_and, &, bi_bit_and)
+      VM_INT_OP(op_bit_or, |, bi_bit_or)
+      VM_INT_OP(op_bit_xor, ^, bi_bit_xor)
+      VM_INT_CMP(op_eq, ==, bi_eq)
+      VM_INT_CMP(op_lt, <, bi_lt)
+      VM_INT_CMP(op_le, <=, bi_le)
+      VM_INT_CMP(op_ge, >=, bi_ge)
+      VM_INT_CMP(op_gt, >, bi_gt)
+    case op_builtin:
+      regs[instr.a] = apply_builtin(NULL, chunk->builtins[instr.c], instr.n, regs + instr.b);
+      break;
+    case op_call:
+    case op_tailcall:
+    {
+      const char *name = chunk->constants[instr.c].word;
+      const int number_of_given_args = instr.n;
+      form_t *args = regs + instr.b;
+      const built_in_func_t *builtin;
+      const FuncMacro *func_macro = resolve_call(&chunk->call_caches[instr.c], name, &builtin);
+      if (func_macro == NULL)
+      {
+        if (builtin == NULL)
+          program_error("Error: unknown function %.*s\n", symbol_length(name), name);
+        regs[instr.a] = apply_builtin(name, builtin, number_of_given_args, args);
+        break;
+      }
+      if (func_macro->is_macro)
+        program_error("Error: %.*s became a macro while a caller was running on the vm\n", symbol_length(name), name);
+      assert_func_macro_arity(func_macro, number_of_given_args);
+      // the arguments become the first registers of the callee
+      const int arity = func_macro->arity;
+      if (func_macro->rest_param != NULL)
+      {
+        const int number_of_rest_args = number_of_given_args - arity;
+        form_t rest = unit;
+        if (number_of_rest_args > 0)
+        {
+          form_t *rest_forms = gc_alloc_backing(number_of_rest_args, number_of_rest_args);
+          memcpy(rest_forms, args + arity, sizeof(form_t) * number_of_rest_args);
+          rest = (form_t){.tag = form_list, .len = number_of_rest_args, .forms = rest_forms};
+        }
+        args[arity] = rest;
+      }
+      const vm_chunk_t *callee = vm_chunk_for(func_macro);
+      if (callee == &vm_not_compilable)
+      {
+        regs[instr.a] = apply_func_macro(func_macro, args);
+        break;
+      }
+      if (instr.op == op_tailcall && n_frames > 0)
+      {
+        // the arguments become the first registers of the current frame, its caller gets the result
+        const int n_params = arity + (func_macro->rest_param != NULL);
+        memmove(regs, args, sizeof(form_t) * n_params);
+        const size_t regs_offset = regs - interp->vm_registers;
+        vm_reserve_registers(regs_offset + callee->n_regs);
+        regs = interp->vm_registers + regs_offset;
+        for (int i = n_params; i < callee->n_regs; i++)
+          regs[i].tag = 0;
+        if (regs_offset + callee->n_regs > interp->vm_registers_live)
+          interp->vm_registers_live = regs_offset + callee->n_regs;
+        if (profiling)
+        {
+          profile_exit();
+          profile_enter(profile_func_entry(name));
+        }
+        chunk = callee;
+        pc = callee->code;
+        break;
+      }
+      const size_t regs_offset = regs - interp->vm_registers;
+      const size_t args_offset = args - interp->vm_registers;
+      if (n_frames >= interp->vm_frames_cap || n_frames >= max_depth || args_offset + callee->n_regs > interp->vm_registers_cap)
+      {
+        vm_reserve_frames(n_frames + 1);
+        vm_reserve_registers(args_offset + callee->n_regs);
+      }
+      interp->vm_frames[n_frames++] = (vm_frame_t){.chunk = chunk, .pc = pc, .regs = regs_offset, .live = interp->vm_registers_live, .result_reg = instr.a};
+      if (profiling)
+        profile_enter(profile_func_entry(name));
+      chunk = callee;
+      pc = callee->code;
+      regs = interp->vm_registers + args_offset;
+      {
+        // the collector only looks at the tag of a cleared register
+        const int n_params = arity + (func_macro->rest_param != NULL);
+        for (int i = n_params; i < callee->n_regs; i++)
+          regs[i].tag = 0;
+        if (args_offset + callee->n_regs > interp->vm_registers_live)
+          interp->vm_registers_live = args_offset + callee->n_regs;
+      }
+      break;
+    }
+    case op_return:
+    {
+      const form_t result = regs[instr.a];
+      if (n_frames == 0)
+      {
+        interp->vm_registers_live = 0;
+        return result;
+      }
+      if (profiling)
+        profile_exit();
+      const vm_frame_t frame = interp->vm_frames[--n_frames];
+      chunk = frame.chunk;
+      pc = frame.pc;
+      regs = interp->vm_registers + frame.regs;
+      interp->vm_registers_live = frame.live;
+      regs[frame.result_reg] = result;
+      break;
+    }
+    default:
+      flush_output();
+      printf("vm Error: unknown op %d\n", instr.op);
+      exit(1);
+    }
+  }
+}
+
+void gc_mark_form(form_t form)
+{
+  if (form.tag != form_list || form.len == 0)
+    return;
+  backing_header_t *header = backing_header(form.forms);
+  if (!header->in_heap || header->marked)
+    return;
+  header->marked = 1;
+  if (interp->gc_mark_stack.len == interp->gc_mark_stack.cap)
+  {
+    interp->gc_mark_stack.cap = interp->gc_mark_stack.cap == 0 ? 1024 : interp->gc_mark_stack.cap * 2;
+    interp->gc_mark_stack.headers = realloc(interp->gc_mark_stack.headers, sizeof(backing_header_t *) * interp->gc_mark_stack.cap);
+  }
+  interp->gc_mark_stack.headers[interp->gc_mark_stack.len++] = header;
+}
+
+void gc_mark_range(const form_t *forms, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    gc_mark_form(forms[i]);
+}
+
+void gc_collect()
+{
+  const uint64_t start = profile_now();
+  for (size_t i = 0; i < interp->gc_roots.len; i++)
+    gc_mark_range(interp->gc_roots.ranges[i].forms, interp->gc_roots.ranges[i].n);
+  gc_mark_range(interp->vm_registers, interp->vm_registers_live);
+  for (const value_segment_t *segment = interp->value_stack; segment != NULL; segment = segment->below)
+    gc_mark_range(segment->values, segment->used);
+  // the whole used part of a backing array is traced as other views may see more of it than the one that reached it
+  while (interp->gc_mark_stack.len > 0)
+  {
+    const backing_header_t *header = interp->gc_mark_stack.headers[--interp->gc_mark_stack.len];
+    gc_mark_range((const form_t *)(header + 1), header->used);
+  }
+  gc_object_t **link = &interp->gc.objects;
+  size_t live = 0;
+  while (*link != NULL)
+  {
+    gc_object_t *object = *link;
+    backing_header_t *header = (backing_header_t *)(object + 1);
+    if (header->marked)
+    {
+      header->marked = 0;
+      live += object->size;
+      link = &object->next;
+      continue;
+    }
+    *link = object->next;
+    free(object);
+    interp->gc.freed_objects++;
+  }
+  interp->gc.bytes = live;
+  interp->gc.live_bytes = live;
+  interp->gc.threshold = live * 2 > GC_MIN_THRESHOLD ? live * 2 : GC_MIN_THRESHOLD;
+  const uint64_t pause = profile_now() - start;
+  interp->gc.collections++;
+  interp->gc.total_pause_ns += pause;
+  if (pause > interp->gc.max_pause_ns)
+    interp->gc.max_pause_ns = pause;
+}
+
+bool gc_stats = false;
+
+void print_gc_stats()
+{
+  fprintf(stderr, "gc: %zu collections, pause total %.3f ms max %.3f ms\n", interp->gc.collections, interp->gc.total_pause_ns / 1e6, interp->gc.max_pause_ns / 1e6);
+  fprintf(stderr, "gc: live after last collection %zu bytes, peak heap %zu bytes\n", interp->gc.live_bytes, interp->gc.peak_bytes);
+  fprintf(stderr, "gc: %zu objects freed by collections, %zu released after their top-level form\n", interp->gc.freed_objects, interp->gc.released_objects);
+}
+
+bool call_cache_stats = false;
+
+void print_call_cache_stats()
+{
+  const size_t calls = interp->call_cache_hits + interp->call_cache_misses;
+  fprintf(stderr, "call cache: %zu hits, %zu misses, %.2f%% hit rate, definition epoch %d\n", interp->call_cache_hits, interp->call_cache_misses,
+          calls == 0 ? 0.0 : 100.0 * interp->call_cache_hits / calls, interp->definition_epoch);
+}
+
+// everything made while evaluating a top-level form is garbage once its result is printed
+void end_top_level_form()
+{
+  arena_reset(&interp->transient_arena);
+  gc_release_all();
+}
+
+typedef enum
+{
+  engine_eval = 1,
+  engine_vm,
+} engine_kind;
+
+engine_kind engine = engine_eval;
+
+// evaluates a compiled top-level form on the selected engine
+form_t eval_top_level(const node_t *node)
+{
+  if (engine == engine_vm && node->kind != node_definition)
+  {
+    const vm_chunk_t *chunk = vm_compile(0, 1, &node, &interp->transient_arena);
+    if (chunk != NULL)
+      return vm_execute(chunk);
+  }
+  return eval(node, NULL);
+}
+
+// a mix of wide data lists, deeply nested lists and code like forms, about size bytes
+char *synthetic_parse_input(size_t size, size_t *out_size)
+{
+  char *text = malloc(size + 4096);
+  size_t n = 0;
+  unsigned seed = 1;
+  for (int form = 0; n < size; form++)
+  {
+    switch (form % 3)
+    {
+    case 0:
+      // a codepoint table
+      n += sprintf(text + n, "[quote [");
+      for (int i = 0; i < 512; i++)
+        n += sprintf(text + n, "%d ", (seed = seed * 1103515245 + 12345) % 0x110000);
+      n += sprintf(text + n, "]]\n");
+      break;
+    case 1:
+      for (int i = 0; i < 128; i++)
+        text[n++] = '[';
+      n += sprintf(text + n, "deep");
+      for (int i = 0; i < 128; i++)
+        text[n++] = ']';
+      text[n++] = '\n';
+      break;
+    default:
+      n += sprintf(text + n, "[func fib [n]\n  [if [lt n [quote 2]]\n    n\n    [add [fib [sub n [quote 1]]] [fib [sub n [quote 2]]]]]]\n");
+      break;
+    }
+  }
+  *out_size = n;
+  return text;
+}
+
+double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// parses all forms without evaluating them and reports throughput
+void bench_parse(FileLexerState *st)
+{
+  const size_t bytes = st->lim - st->buf;
+  size_t top_level_forms = 0;
+  interp->parsed_forms = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int c;
+  while ((st->tok = st->cur, c = peek_char(st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(st, WHITESPACE);
+      continue;
+    }
+    parse(st);
+    top_level_forms++;
+    arena_reset(&interp->transient_arena);
+  }
+  const double elapsed = seconds_since(&start);
+  printf("parsed %zu top-level forms, %zu forms, %zu bytes in %.3f s\n", top_level_forms, interp->parsed_forms, bytes, elapsed);
+  printf("%.0f forms/s %.1f MB/s\n", interp->parsed_forms / elapsed, bytes / elapsed / (1024 * 1024));
+}
+
+// a wide list of ints, words and small lists, or a list nested depth deep, as text
+char *synthetic_print_input(bool deep, int n, size_t *out_size)
+{
+  char *text = malloc((size_t)n * 16 + 16);
+  size_t n_chars = 0;
+  unsigned seed = 1;
+  if (deep)
+  {
+    for (int i = 0; i < n; i++)
+      n_chars += sprintf(text + n_chars, "[d%d ", i % 10);
+    text[n_chars++] = '[';
+    for (int i = 0; i <= n; i++)
+      text[n_chars++] = ']';
+  }
+  else
+  {
+    text[n_chars++] = '[';
+    for (int i = 0; i < n; i++)
+      switch (i % 4)
+      {
+      case 0:
+      case 1:
+        n_chars += sprintf(text + n_chars, "%d ", (int)(seed = seed * 1103515245 + 12345));
+        break;
+      case 2:
+        n_chars += sprintf(text + n_chars, "item ");
+        break;
+      default:
+        n_chars += sprintf(text + n_chars, "[a %d []] ", i);
+        break;
+      }
+    text[n_chars++] = ']';
+  }
+  *out_size = n_chars;
+  return text;
+}
+
+// prints a wide and a deep list to /dev/null repetitions times each and reports the throughput of the printer
+void bench_print(int repetitions)
+{
+  FILE *sink = fopen("/dev/null", "w");
+  for (int deep = 0; deep < 2; deep++)
+  {
+    size_t size;
+    char *text = synthetic_print_input(deep, 1 << 20, &size);
+    FileLexerState st;
+    init_memory_lexer(&st, text, size);
+    st.tok = st.cur;
+    const form_t form = parse(&st);
+    set_output(sink);
+    const size_t written_before = interp->output.written;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repetitions; i++)
+    {
+      print_form(form);
+      output_char('\n');
+    }
+    flush_output();
+    const double elapsed = seconds_since(&start);
+    const size_t bytes = interp->output.written - written_before;
+    set_output(stdout);
+    printf("%s list: printed %zu bytes in %.3f s, %.1f MB/s\n", deep ? "deep" : "wide", bytes, elapsed, bytes / elapsed / (1024 * 1024));
+    arena_reset(&interp->transient_arena);
+    free(text);
+  }
+  fclose(sink);
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// prints the source of a form as a json string, shortened to max_len bytes
+void print_json_source(const char *source, size_t len, size_t max_len)
+{
+  printf("\"");
+  for (size_t i = 0; i < len && i < max_len; i++)
+    if (source[i] == '\n')
+      printf(" ");
+    else
+      putchar(source[i]);
+  printf(len > max_len ? "...\"" : "\"");
+}
+
+// region for the form being benchmarked so it survives the transient resets between repetitions
+arena_t bench_arena = {.head = NULL, .free_blocks = NULL};
+
+// evaluates every top-level form warmup times then times it over repetitions and prints the results as json
+// definitions are evaluated once as evaluating them again would redefine them
+void bench_forms(FileLexerState *st, int warmup, int repetitions)
+{
+  double *times = malloc(sizeof(double) * repetitions);
+  printf("{\"engine\": \"%s\", \"warmup\": %d, \"repetitions\": %d, \"forms\": [", engine == engine_vm ? "vm" : "eval", warmup, repetitions);
+  int index = 0;
+  int c;
+  while ((st->tok = st->cur, c = peek_char(st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(st, WHITESPACE);
+      continue;
+    }
+    const char *source = st->cur;
+    const form_t form = promote_form(&bench_arena, parse(st));
+    const size_t source_len = st->cur - source;
+    arena_reset(&interp->transient_arena);
+    const bool is_definition = form.tag == form_list && form.len > 0 && (form_items(form)[0].word == sym_func || form_items(form)[0].word == sym_macro);
+    const int runs = is_definition ? 1 : repetitions;
+    if (!is_definition)
+      for (int i = 0; i < warmup; i++)
+      {
+        eval_top_level(compile(form, NULL));
+        end_top_level_form();
+      }
+    const size_t allocations_before = interp->arena_allocation_count;
+    const size_t bytes_before = interp->arena_allocated_bytes;
+    for (int i = 0; i < runs; i++)
+    {
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      eval_top_level(compile(form, NULL));
+      times[i] = seconds_since(&start);
+      end_top_level_form();
+    }
+    const size_t allocations = (interp->arena_allocation_count - allocations_before) / runs;
+    const size_t bytes = (interp->arena_allocated_bytes - bytes_before) / runs;
+    double total = 0;
+    for (int i = 0; i < runs; i++)
+      total += times[i];
+    qsort(times, runs, sizeof(double), compare_doubles);
+    // what the form printed goes before its entry
+    flush_output();
+    printf("%s\n  {\"index\": %d, \"source\": ", index == 0 ? "" : ",", index);
+    print_json_source(source, source_len, 80);
+    printf(", \"definition\": %s, \"runs\": %d, \"min_ns\": %.0f, \"median_ns\": %.0f, \"mean_ns\": %.0f, \"max_ns\": %.0f, \"allocations\": %zu, \"bytes\": %zu}",
+           is_definition ? "true" : "false", runs, times[0] * 1e9, times[runs / 2] * 1e9, total / runs * 1e9, times[runs - 1] * 1e9, allocations, bytes);
+    arena_reset(&bench_arena);
+    index++;
+  }
+  printf("\n]}\n");
+  free(times);
+}
+
+// top-level forms of the --prelude file, parsed once and only read by the interpreters that evaluate them
+arena_t prelude_arena = {.head = NULL, .free_blocks = NULL};
+form_t *prelude_forms = NULL;
+size_t prelude_len = 0;
+
+void load_prelude(const char *filename)
+{
+  FILE *file = fopen(filename, "r");
+  if (file == NULL)
+  {
+    printf("Error: could not open prelude %s\n", filename);
+    exit(1);
+  }
+  // the file stays open and mapped so words may point into it
+  FileLexerState st;
+  if (!init_mapped_lexer(&st, file))
+    init_lexer(&st, file);
+  size_t cap = 0;
+  int c;
+  while ((st.tok = st.cur, c = peek_char(&st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(&st, WHITESPACE);
+      continue;
+    }
+    if (prelude_len == cap)
+    {
+      cap = cap == 0 ? 64 : cap * 2;
+      prelude_forms = realloc(prelude_forms, sizeof(form_t) * cap);
+    }
+    prelude_forms[prelude_len++] = promote_form(&prelude_arena, parse(&st));
+    arena_reset(&interp->transient_arena);
+  }
+}
+
+// evaluates the prelude in the current interpreter without printing the results
+void run_prelude()
+{
+  for (size_t i = 0; i < prelude_len; i++)
+  {
+    eval_top_level(compile(prelude_forms[i], NULL));
+    end_top_level_form();
+  }
+}
+
+// evaluates a top-level form and prints its result
+void run_form(form_t form)
+{
+  form_t evaluated = eval_top_level(compile(form, NULL));
+  print_form(evaluated);
+  output_char('\n');
+  // nothing from the transient region or the heap is reachable after printing
+  end_top_level_form();
+}
+
+// evaluates the top-level forms of st in order and prints their results
+void run_forms(FileLexerState *st)
+{
+  int c;
+  while ((st->tok = st->cur, c = peek_char(st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(st, WHITESPACE);
+      continue;
+    }
+    run_form(parse(st));
+  }
+}
+
+// an image holds the func/macro definitions of an interpreter so later runs can load them instead of evaluating their source
+// it is mapped private and relocated in place once, offsets become pointers and words are interned, bodies are compiled on first call
+// the image is made of form_t records so only the build that wrote it can read it
+#define IMAGE_MAGIC "unsimg2"
+// marks a missing rest parameter
+#define IMAGE_NULL UINT64_MAX
+
+typedef struct
+{
+  char magic[8];
+  uint32_t form_size;
+  uint32_t n_definitions;
+  // sections from the start of the image, the forms section is a sequence of backing arrays
+  uint64_t forms;
+  uint64_t definitions;
+  uint64_t words;
+  uint64_t size;
+  // gensyms made by the interpreters that load the image continue from it so they cannot collide with gensyms in the definitions
+  uint64_t gensym_counter;
+} image_header_t;
+
+// a distinct word of the image, interned when it is loaded
+typedef struct
+{
+  const char *interned;
+  uint64_t len;
+  char chars[];
+} image_word_t;
+
+// pointers hold offsets into their section until the image is relocated
+// parameters has arity + 1 entries like FuncMacro, the last is the rest parameter
+typedef struct
+{
+  const char *name;
+  uint32_t is_macro;
+  int32_t arity;
+  const char **parameters;
+  const char *rest_param;
+  int64_t n_of_bodies;
+  const form_t *bodies;
+} image_definition_t;
+
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+} image_buffer_t;
+
+typedef struct
+{
+  image_buffer_t forms;
+  image_buffer_t definitions;
+  image_buffer_t words;
+  // open addressing from an interned word to its offset in words
+  size_t cap_words;
+  size_t n_words;
+  const char **word_keys;
+  uint64_t *word_offsets;
+} image_writer_t;
+
+// appends size zeroed bytes, keeping every record 8 byte aligned, returns their offset
+uint64_t image_reserve(image_buffer_t *buffer, size_t size)
+{
+  size = (size + 7) & ~(size_t)7;
+  if (buffer->len + size > buffer->cap)
+  {
+    while (buffer->len + size > buffer->cap)
+      buffer->cap = buffer->cap == 0 ? 64 * 1024 : buffer->cap * 2;
+    buffer->data = realloc(buffer->data, buffer->cap);
+  }
+  memset(buffer->data + buffer->len, 0, size);
+  const uint64_t offset = buffer->len;
+  buffer->len += size;
+  return offset;
+}
+
+// the offset of the record of word, written the first time it is seen
+uint64_t image_word(image_writer_t *w, const char *word, size_t len)
+{
+  if ((w->n_words + 1) * 2 > w->cap_words)
+  {
+    const size_t old_cap = w->cap_words;
+    const char **old_keys = w->word_keys;
+    uint64_t *old_offsets = w->word_offsets;
+    w->cap_words = old_cap == 0 ? 1024 : old_cap * 2;
+    w->word_keys = calloc(w->cap_words, sizeof(char *));
+    w->word_offsets = malloc(sizeof(uint64_t) * w->cap_words);
+    for (size_t i = 0; i < old_cap; i++)
+    {
+      if (old_keys[i] == NULL)
+        continue;
+      size_t j = hash_symbol(old_keys[i]) & (w->cap_words - 1);
+      while (w->word_keys[j] != NULL)
+        j = (j + 1) & (w->cap_words - 1);
+      w->word_keys[j] = old_keys[i];
+      w->word_offsets[j] = old_offsets[i];
+    }
+    free(old_keys);
+    free(old_offsets);
+  }
+  size_t i = hash_symbol(word) & (w->cap_words - 1);
+  for (; w->word_keys[i] != NULL; i = (i + 1) & (w->cap_words - 1))
+    if (w->word_keys[i] == word)
+      return w->word_offsets[i];
+  const uint64_t offset = image_reserve(&w->words, sizeof(image_word_t) + len);
+  image_word_t *record = (image_word_t *)(w->words.data + offset);
+  record->len = len;
+  memcpy(record->chars, word, len);
+  w->word_keys[i] = word;
+  w->word_offsets[i] = offset;
+  w->n_words++;
+  return offset;
+}
+
+// appends a backing array holding a copy of n forms, returns the offset of its first form
+uint64_t image_put_forms(image_writer_t *w, const form_t *forms, size_t n)
+{
+  const uint64_t header = image_reserve(&w->forms, sizeof(backing_header_t) + sizeof(form_t) * n);
+  *(backing_header_t *)(w->forms.data + header) = (backing_header_t){.cap = n, .used = n, .in_heap = 0, .marked = 0};
+  if (n > 0)
+    memcpy(w->forms.data + header + sizeof(backing_header_t), forms, sizeof(form_t) * n);
+  return header + sizeof(backing_header_t);
+}
+
+// copies n forms and all lists they reach into the forms section, words and lists refer to their records by offset
+uint64_t image_forms(image_writer_t *w, const form_t *forms, size_t n)
+{
+  typedef struct
+  {
+    uint64_t offset;
+    size_t n;
+  } pending_t;
+  size_t cap_pending = 64, n_pending = 0;
+  pending_t *pending = malloc(sizeof(pending_t) * cap_pending);
+  const uint64_t first = image_put_forms(w, forms, n);
+  pending[n_pending++] = (pending_t){.offset = first, .n = n};
+  while (n_pending > 0)
+  {
+    const pending_t array = pending[--n_pending];
+    for (size_t i = 0; i < array.n; i++)
+    {
+      // the buffer moves when it grows
+      form_t *form = (form_t *)(w->forms.data + array.offset) + i;
+      if (form->tag == form_word)
+        form->word = (const char *)(uintptr_t)image_word(w, form->word, form->len);
+      else if (form->tag == form_list && form->len > 0)
+      {
+        const form_t list = *form;
+        const uint64_t offset = image_put_forms(w, form_items(list), list.len);
+        form = (form_t *)(w->forms.data + array.offset) + i;
+        form->off = 0;
+        form->forms = (form_t *)(uintptr_t)offset;
+        if (n_pending == cap_pending)
+        {
+          cap_pending *= 2;
+          pending = realloc(pending, sizeof(pending_t) * cap_pending);
+        }
+        pending[n_pending++] = (pending_t){.offset = offset, .n = list.len};
+      }
+      else if (form->tag == form_list)
+        form->forms = NULL;
+    }
+  }
+  free(pending);
+  return first;
+}
+
+void image_writer_free(image_writer_t *w)
+{
+  free(w->forms.data);
+  free(w->definitions.data);
+  free(w->words.data);
+  free(w->word_keys);
+  free(w->word_offsets);
+}
+
+// writes the func/macro definitions of the current interpreter to filename
+void save_image(const char *filename)
+{
+  image_writer_t w = {0};
+  uint32_t n_definitions = 0;
+  for (int i = 0; i < interp->func_macro_env.cap; i++)
+    if (interp->func_macro_env.bindings[i].func_macro != NULL)
+      n_definitions++;
+  const uint64_t definitions = image_reserve(&w.definitions, sizeof(image_definition_t) * n_definitions);
+  uint32_t k = 0;
+  for (int i = 0; i < interp->func_macro_env.cap; i++)
+  {
+    const FuncMacro *func_macro = interp->func_macro_env.bindings[i].func_macro;
+    if (func_macro == NULL)
+      continue;
+    const uint64_t parameters = image_reserve(&w.definitions, sizeof(uint64_t) * (func_macro->arity + 1));
+    for (int j = 0; j <= func_macro->arity; j++)
+    {
+      const char *parameter = func_macro->parameters[j];
+      ((uint64_t *)(w.definitions.data + parameters))[j] = parameter == NULL ? IMAGE_NULL : image_word(&w, parameter, symbol_length(parameter));
+    }
+    const uint64_t bodies = image_forms(&w, func_macro->bodies, func_macro->n_of_bodies);
+    const char *rest_param = func_macro->rest_param;
+    image_definition_t *definition = (image_definition_t *)(w.definitions.data + definitions) + k++;
+    *definition = (image_definition_t){
+        .name = (const char *)(uintptr_t)image_word(&w, func_macro->name, symbol_length(func_macro->name)),
+        .is_macro = func_macro->is_macro,
+        .arity = func_macro->arity,
+        .parameters = (const char **)(uintptr_t)parameters,
+        .rest_param = (const char *)(uintptr_t)(rest_param == NULL ? IMAGE_NULL : image_word(&w, rest_param, symbol_length(rest_param))),
+        .n_of_bodies = func_macro->n_of_bodies,
+        .bodies = (const form_t *)(uintptr_t)bodies,
+    };
+  }
+  image_header_t header = {.magic = IMAGE_MAGIC, .form_size = sizeof(form_t), .n_definitions = n_definitions, .gensym_counter = interp->gensym_counter};
+  header.forms = sizeof(image_header_t);
+  header.definitions = header.forms + w.forms.len;
+  header.words = header.definitions + w.definitions.len;
+  header.size = header.words + w.words.len;
+  FILE *out = fopen(filename, "wb");
+  if (out == NULL)
+  {
+    printf("Error: could not open image %s\n", filename);
+    exit(1);
+  }
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(w.forms.data, 1, w.forms.len, out);
+  fwrite(w.definitions.data, 1, w.definitions.len, out);
+  fwrite(w.words.data, 1, w.words.len, out);
+  fclose(out);
+  image_writer_free(&w);
+}
+
+// definitions of the --image file, relocated once and only read by the interpreters that define them
+const image_definition_t *image_definitions = NULL;
+uint32_t image_len = 0;
+uint64_t image_gensym_counter = 0;
+
+const char *image_word_at(const char *words, uint64_t offset)
+{
+  return offset == IMAGE_NULL ? NULL : ((const image_word_t *)(words + offset))->interned;
+}
+
+// the sections of a mapped image or ast cache, checked before anything in them is relocated so a damaged file is rejected rather than followed
+// offsets of word records and backing arrays must be where the writer put records, one bit per 8 bytes of their section marks those
+typedef struct
+{
+  char *forms;
+  uint64_t forms_size;
+  char *words;
+  uint64_t words_size;
+  // the array of the top-level forms of an ast cache is written after the arrays its lists refer to, IMAGE_NULL in an image
+  uint64_t top;
+  uint8_t *word_starts;
+  uint8_t *array_starts;
+} image_check_t;
+
+bool image_check_bit(const uint8_t *bits, uint64_t offset)
+{
+  return offset % 8 == 0 && (bits[offset / 64] >> (offset / 8 % 8) & 1);
+}
+
+void image_check_set_bit(uint8_t *bits, uint64_t offset)
+{
+  bits[offset / 64] |= 1 << (offset / 8 % 8);
+}
+
+// whether offset is the start of a word record, of len chars unless len is negative
+bool image_check_word(const image_check_t *c, uint64_t offset, int64_t len)
+{
+  return offset < c->words_size && image_check_bit(c->word_starts, offset) &&
+         (len < 0 || ((const image_word_t *)(c->words + offset))->len == (uint64_t)len);
+}
+
+// whether offset is the first form of a backing array of at least n forms
+bool image_check_array(const image_check_t *c, uint64_t offset, uint64_t n)
+{
+  return offset < c->forms_size && image_check_bit(c->array_starts, offset) &&
+         ((const backing_header_t *)(c->forms + offset) - 1)->cap >= n;
+}
+
+// walks the word records and then the backing arrays, whose lists may only refer to later arrays but the top one so they cannot form cycles
+bool image_check_sections(image_check_t *c)
+{
+  if ((uintptr_t)c->forms % 8 != 0 || (uintptr_t)c->words % 8 != 0)
+    return false;
+  c->word_starts = calloc(c->words_size / 64 + 1, 1);
+  c->array_starts = calloc(c->forms_size / 64 + 1, 1);
+  for (uint64_t offset = 0; offset < c->words_size;)
+  {
+    const image_word_t *record = (const image_word_t *)(c->words + offset);
+    if (c->words_size - offset < sizeof(image_word_t) || c->words_size - offset - sizeof(image_word_t) < record->len)
+      return false;
+    image_check_set_bit(c->word_starts, offset);
+    offset += (sizeof(image_word_t) + record->len + 7) & ~(uint64_t)7;
+  }
+  for (uint64_t offset = 0; offset < c->forms_size;)
+  {
+    const backing_header_t *backing = (const backing_header_t *)(c->forms + offset);
+    if (c->forms_size - offset < sizeof(backing_header_t) ||
+        (c->forms_size - offset - sizeof(backing_header_t)) / sizeof(form_t) < backing->cap ||
+        backing->used != backing->cap || backing->in_heap != 0 || backing->marked != 0)
+      return false;
+    offset += sizeof(backing_header_t);
+    image_check_set_bit(c->array_starts, offset);
+    offset += sizeof(form_t) * backing->cap;
+  }
+  for (uint64_t offset = 0; offset < c->forms_size;)
+  {
+    const backing_header_t *backing = (const backing_header_t *)(c->forms + offset);
+    const uint64_t first = offset + sizeof(backing_header_t);
+    const form_t *items = (const form_t *)(backing + 1);
+    for (uint32_t i = 0; i < backing->cap; i++)
+    {
+      const form_t item = items[i];
+      const uint64_t target = (uintptr_t)item.forms;
+      if (item.tag == form_word ? item.len < 0 || !image_check_word(c, (uintptr_t)item.word, item.len)
+          : item.tag == form_list ? item.len < 0 || (item.len > 0 && (item.off != 0 || target == c->top || (first != c->top && target <= first) || !image_check_array(c, target, item.len)))
+                                  : item.tag != form_int)
+        return false;
+    }
+    offset = first + sizeof(form_t) * backing->cap;
+  }
+  return true;
+}
+
+void image_check_free(image_check_t *c)
+{
+  free(c->word_starts);
+  free(c->array_starts);
+}
+
+// whether the sections of a file of size bytes follow its header in order and end with it
+bool image_check_layout(uint64_t header_size, const uint64_t *sections, int n, uint64_t size)
+{
+  uint64_t previous = header_size;
+  for (int i = 0; i < n; i++)
+  {
+    if (sections[i] < previous || sections[i] % 8 != 0)
+      return false;
+    previous = sections[i];
+  }
+  return previous <= size;
+}
+
+// whether the definitions of a checked image refer to word records and body arrays and each has its own parameters after the definitions
+bool image_check_definitions(const image_check_t *c, const image_definition_t *definitions, uint32_t n, uint64_t size)
+{
+  uint64_t parameters_start = sizeof(image_definition_t) * (uint64_t)n;
+  if (parameters_start > size)
+    return false;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const image_definition_t *definition = &definitions[i];
+    const uint64_t parameters = (uintptr_t)definition->parameters;
+    if (definition->is_macro > 1 || definition->arity < 0 || definition->n_of_bodies < 0 ||
+        !image_check_word(c, (uintptr_t)definition->name, -1) ||
+        (definition->rest_param != (const char *)(uintptr_t)IMAGE_NULL && !image_check_word(c, (uintptr_t)definition->rest_param, -1)) ||
+        !image_check_array(c, (uintptr_t)definition->bodies, definition->n_of_bodies) ||
+        parameters < parameters_start || parameters % 8 != 0 || parameters > size ||
+        (size - parameters) / sizeof(uint64_t) < (uint64_t)definition->arity + 1)
+      return false;
+    const uint64_t *parameter_offsets = (const uint64_t *)((const char *)definitions + parameters);
+    for (int j = 0; j <= definition->arity; j++)
+      if (!(j == definition->arity && parameter_offsets[j] == IMAGE_NULL) && !image_check_word(c, parameter_offsets[j], -1))
+        return false;
+    parameters_start = parameters + sizeof(uint64_t) * ((uint64_t)definition->arity + 1);
+  }
+  return true;
+}
+
+// interns the word records from words to end
+void image_intern_words(char *words, const char *end)
+{
+  for (char *p = words; p < end;)
+  {
+    image_word_t *record = (image_word_t *)p;
+    record->interned = intern_with_storage(record->chars, record->len, record->chars);
+    p += (sizeof(image_word_t) + record->len + 7) & ~(size_t)7;
+  }
+}
+
+// turns the offsets in the backing arrays from forms to end into pointers, words must be interned first
+void image_relocate_forms(char *forms, const char *end, const char *words)
+{
+  for (char *p = forms; p < end;)
+  {
+    const backing_header_t *backing = (const backing_header_t *)p;
+    form_t *items = (form_t *)(backing + 1);
+    for (uint32_t i = 0; i < backing->cap; i++)
+      if (items[i].tag == form_word)
+        items[i].word = image_word_at(words, (uintptr_t)items[i].word);
+      else if (items[i].tag == form_list && items[i].len > 0)
+        items[i].forms = (form_t *)(forms + (uintptr_t)items[i].forms);
+    p = (char *)(items + backing->cap);
+  }
+}
+
+void load_image(const char *filename)
+{
+  const int fd = open(filename, O_RDONLY);
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(image_header_t))
+  {
+    printf("Error: could not open image %s\n", filename);
+    exit(1);
+  }
+  // private so relocating writes to copies of the pages, the mapping is never unmapped as words point into it
+  char *base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  const image_header_t *header = (const image_header_t *)base;
+  if (base == MAP_FAILED || memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || header->form_size != sizeof(form_t))
+  {
+    printf("Error: %s is not an image of this build\n", filename);
+    exit(1);
+  }
+  image_check_t check = {
+      .forms = base + header->forms,
+      .forms_size = header->definitions - header->forms,
+      .words = base + header->words,
+      .words_size = header->size - header->words,
+      .top = IMAGE_NULL,
+  };
+  const uint64_t sections[] = {header->forms, header->definitions, header->words};
+  const bool valid = header->size == (uint64_t)sb.st_size && image_check_layout(sizeof(image_header_t), sections, 3, header->size) && image_check_sections(&check) &&
+                     image_check_definitions(&check, (const image_definition_t *)(base + header->definitions), header->n_definitions, header->words - header->definitions);
+  image_check_free(&check);
+  if (!valid)
+  {
+    printf("Error: image %s is damaged\n", filename);
+    exit(1);
+  }
+  const char *words = base + header->words;
+  image_intern_words(base + header->words, base + header->size);
+  char *forms_base = base + header->forms;
+  image_relocate_forms(forms_base, base + header->definitions, words);
+  image_definition_t *definitions = (image_definition_t *)(base + header->definitions);
+  for (uint32_t i = 0; i < header->n_definitions; i++)
+  {
+    image_definition_t *definition = &definitions[i];
+    const char **parameters = (const char **)(base + header->definitions + (uintptr_t)definition->parameters);
+    for (int j = 0; j <= definition->arity; j++)
+      parameters[j] = image_word_at(words, ((uint64_t *)parameters)[j]);
+    definition->name = image_word_at(words, (uintptr_t)definition->name);
+    definition->parameters = parameters;
+    definition->rest_param = image_word_at(words, (uintptr_t)definition->rest_param);
+    definition->bodies = (const form_t *)(forms_base + (uintptr_t)definition->bodies);
+  }
+  image_definitions = definitions;
+  image_len = header->n_definitions;
+  image_gensym_counter = header->gensym_counter;
+}
+
+// defines the image definitions in the current interpreter, their bodies are compiled when first called
+void define_image()
+{
+  for (uint32_t i = 0; i < image_len; i++)
+  {
+    const image_definition_t *definition = &image_definitions[i];
+    const FuncMacro func_macro = {
+        .name = definition->name,
+        .is_macro = definition->is_macro,
+        .arity = definition->arity,
+        .parameters = definition->parameters,
+        .rest_param = definition->rest_param,
+        .n_of_bodies = definition->n_of_bodies,
+        .bodies = definition->bodies,
+        .body_nodes = NULL,
+        .chunk = NULL,
+    };
+    FuncMacro *stored_func_macro = arena_alloc(&interp->permanent_arena, sizeof(FuncMacro));
+    memcpy(stored_func_macro, &func_macro, sizeof(FuncMacro));
+    insert_func_macro_binding(definition->name, stored_func_macro);
+  }
+  if ((uint64_t)interp->gensym_counter < image_gensym_counter)
+    interp->gensym_counter = image_gensym_counter;
+}
+
+// --ast-cache keeps the parsed forms of a file in <file>.ast next to it, made of the same word and backing array records as an image
+// it is valid while the hash and size of the source match, then it is mapped and relocated instead of parsing the source
+#define AST_CACHE_MAGIC "unsast1"
+
+typedef struct
+{
+  char magic[8];
+  uint32_t form_size;
+  uint32_t reserved;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t n_forms;
+  // sections from the start of the cache, top is the offset of the backing array of the top-level forms in the forms section
+  uint64_t forms;
+  uint64_t top;
+  uint64_t words;
+  uint64_t size;
+} ast_cache_header_t;
+
+bool ast_cache = false;
+
+// a hash of a whole source file, four independent lanes of 8 bytes so it keeps up with reading the file
+uint64_t hash_source(const char *s, size_t len)
+{
+  uint64_t lanes[4] = {1, 2, 3, 4};
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+    for (int k = 0; k < 4; k++)
+    {
+      uint64_t v;
+      memcpy(&v, s + i + 8 * k, 8);
+      lanes[k] = (lanes[k] ^ v) * 0x9e3779b97f4a7c15ull;
+      lanes[k] ^= lanes[k] >> 29;
+    }
+  uint64_t h = hash_bytes(s + i, len - i) ^ len;
+  for (int k = 0; k < 4; k++)
+  {
+    h = (h ^ lanes[k]) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+char *ast_cache_filename(const char *filename)
+{
+  const size_t len = strlen(filename);
+  char *cache_filename = malloc(len + 5);
+  memcpy(cache_filename, filename, len);
+  memcpy(cache_filename + len, ".ast", 5);
+  return cache_filename;
+}
+
+// the top-level forms of the cache if it is valid for the source, NULL otherwise
+const form_t *load_ast_cache(const char *cache_filename, uint64_t source_hash, size_t source_size, size_t *n_forms)
+{
+  const int fd = open(cache_filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(ast_cache_header_t))
+  {
+    close(fd);
+    return NULL;
+  }
+  // like an image it is mapped private and relocated in place, words point into it so it is never unmapped
+  // relocation writes every page, populating breaks their copy on write in one pass instead of a fault per page
+  char *base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+  const ast_cache_header_t *header = (const ast_cache_header_t *)base;
+  if (memcmp(header->magic, AST_CACHE_MAGIC, sizeof(AST_CACHE_MAGIC)) != 0 || header->form_size != sizeof(form_t) ||
+      header->size != (uint64_t)sb.st_size || header->source_hash != source_hash || header->source_size != source_size)
+  {
+    munmap(base, sb.st_size);
+    return NULL;
+  }
+  // a damaged cache is stale like one of another source, the source is parsed again and the cache rewritten
+  image_check_t check = {
+      .forms = base + header->forms,
+      .forms_size = header->words - header->forms,
+      .words = base + header->words,
+      .words_size = header->size - header->words,
+      .top = header->top,
+  };
+  const uint64_t sections[] = {header->forms, header->words};
+  const bool valid = image_check_layout(sizeof(ast_cache_header_t), sections, 2, header->size) && image_check_sections(&check) &&
+                     image_check_array(&check, header->top, header->n_forms);
+  image_check_free(&check);
+  if (!valid)
+  {
+    munmap(base, sb.st_size);
+    return NULL;
+  }
+  image_intern_words(base + header->words, base + header->size);
+  image_relocate_forms(base + header->forms, base + header->words, base + header->words);
+  *n_forms = header->n_forms;
+  return (const form_t *)(base + header->forms + header->top);
+}
+
+// form with its word and lists replaced by their records in w
+form_t image_form(image_writer_t *w, form_t form)
+{
+  if (form.tag == form_word)
+    form.word = (const char *)(uintptr_t)image_word(w, form.word, form.len);
+  else if (form.tag == form_list)
+  {
+    form.forms = form.len == 0 ? NULL : (form_t *)(uintptr_t)image_forms(w, form_items(form), form.len);
+    form.off = 0;
+  }
+  return form;
+}
+
+// writes a temporary file renamed over the cache so concurrent runs never read a partial cache, a cache that cannot be written is skipped
+void write_ast_cache(const char *cache_filename, image_writer_t *w, const form_t *top, size_t n_forms, uint64_t source_hash, size_t source_size)
+{
+  ast_cache_header_t header = {.magic = AST_CACHE_MAGIC, .form_size = sizeof(form_t), .source_hash = source_hash, .source_size = source_size, .n_forms = n_forms};
+  header.top = image_put_forms(w, top, n_forms);
+  header.forms = sizeof(ast_cache_header_t);
+  header.words = header.forms + w->forms.len;
+  header.size = header.words + w->words.len;
+  const size_t len = strlen(cache_filename);
+  char *temp_filename = malloc(len + 32);
+  sprintf(temp_filename, "%s.%ld.tmp", cache_filename, (long)getpid());
+  FILE *out = fopen(temp_filename, "wb");
+  if (out != NULL)
+  {
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(w->forms.data, 1, w->forms.len, out);
+    fwrite(w->words.data, 1, w->words.len, out);
+    if (fclose(out) != 0 || rename(temp_filename, cache_filename) != 0)
+      unlink(temp_filename);
+  }
+  free(temp_filename);
+}
+
+// runs the forms of the mapped source st of filename from its cache, or parses them and writes the cache
+// without evaluate the forms are only loaded or parsed
+void run_cached_forms(FileLexerState *st, const char *filename, bool evaluate)
+{
+  const size_t source_size = st->lim - st->buf;
+  const uint64_t source_hash = hash_source(st->buf, source_size);
+  char *cache_filename = ast_cache_filename(filename);
+  size_t n_forms;
+  const form_t *forms = load_ast_cache(cache_filename, source_hash, source_size, &n_forms);
+  if (forms != NULL)
+  {
+    for (size_t i = 0; evaluate && i < n_forms; i++)
+      run_form(forms[i]);
+    free(cache_filename);
+    return;
+  }
+  // the cache is only written once every form was parsed and ran
+  image_writer_t w = {0};
+  form_t *top = NULL;
+  size_t cap = 0;
+  n_forms = 0;
+  int c;
+  while ((st->tok = st->cur, c = peek_char(st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(st, WHITESPACE);
+      continue;
+    }
+    const form_t form = parse(st);
+    if (n_forms == cap)
+    {
+      cap = cap == 0 ? 64 : cap * 2;
+      top = realloc(top, sizeof(form_t) * cap);
+    }
+    top[n_forms++] = image_form(&w, form);
+    if (evaluate)
+      run_form(form);
+    else
+      arena_reset(&interp->transient_arena);
+  }
+  write_ast_cache(cache_filename, &w, top, n_forms, source_hash, source_size);
+  image_writer_free(&w);
+  free(top);
+  free(cache_filename);
+}
+
+// times loading the cache of the mapped source st like bench_parse times parsing it, the cache is written first if it is missing or stale
+void bench_ast_cache(FileLexerState *st, const char *filename)
+{
+  const size_t bytes = st->lim - st->buf;
+  char *cache_filename = ast_cache_filename(filename);
+  size_t n_forms;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  const form_t *forms = load_ast_cache(cache_filename, hash_source(st->buf, bytes), bytes, &n_forms);
+  double elapsed = seconds_since(&start);
+  if (forms == NULL)
+  {
+    run_cached_forms(st, filename, false);
+    printf("wrote %s, run again to time loading it\n", cache_filename);
+    free(cache_filename);
+    return;
+  }
+  printf("loaded %zu top-level forms of %zu bytes from %s in %.3f s\n", n_forms, bytes, cache_filename, elapsed);
+  printf("%.1f MB/s of source\n", bytes / elapsed / (1024 * 1024));
+  free(cache_filename);
+}
+
+// --emit-c translates a program into c that includes this file with UNS_NO_MAIN defined and runs on its runtime
+// funcs become c functions whose values live in a rooted frame array, loops become c loops and the arithmetic builtins are inlined for ints
+// definitions are evaluated while compiling so macro calls are expanded then, forms it cannot translate are evaluated from their source when the program runs
+
+// the runtime of compiled programs
+// int fast paths of the builtins with a vm instruction, the builtin handles everything else
+#define AOT_INT_OP(a, b, op, bi) ((a).tag == form_int && (b).tag == form_int ? word_from_int((a).number op(b).number) : bi(a, b))
+#define AOT_INT_CMP(a, b, op, bi) ((a).tag == form_int && (b).tag == form_int ? ((a).number op(b).number ? one : zero) : bi(a, b))
+
+void aot_start(const char *native_stack_base)
+{
+  // static as the gc statistics would read it after main returned
+  static interp_t aot_interp;
+  init_symbols();
+  interp_init(&aot_interp, stdout);
+  flush_output_at_exit();
+  init_native_stack(native_stack_base);
+}
+
+void aot_intern_words(const char **words, const char *const *texts, int n)
+{
+  for (int i = 0; i < n; i++)
+    words[i] = intern_with_storage(texts[i], strlen(texts[i]), texts[i]);
+}
+
+// the text of each constant is parsed once, its words point into the text
+void aot_parse_constants(form_t *constants, const char *const *texts, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    FileLexerState st;
+    init_memory_lexer(&st, (char *)texts[i], strlen(texts[i]));
+    constants[i] = promote_form(&interp->permanent_arena, parse(&st));
+    arena_reset(&interp->transient_arena);
+  }
+}
+
+// defines a compiled func, its parameters are only known to its native code
+form_t aot_define(const char *name, int arity, const char *rest_param, form_t (*native)(form_t *args))
+{
+  const char **parameters = arena_alloc(&interp->permanent_arena, (arity + 1) * sizeof(char *));
+  memset(parameters, 0, (arity + 1) * sizeof(char *));
+  parameters[arity] = rest_param;
+  const FuncMacro func_macro = {
+      .name = name,
+      .is_macro = false,
+      .arity = arity,
+      .parameters = parameters,
+      .rest_param = rest_param,
+      .n_of_bodies = 0,
+      .bodies = NULL,
+      .body_nodes = NULL,
+      .chunk = NULL,
+      .native = native,
+  };
+  FuncMacro *stored_func_macro = arena_alloc(&interp->permanent_arena, sizeof(FuncMacro));
+  memcpy(stored_func_macro, &func_macro, sizeof(FuncMacro));
+  insert_func_macro_binding(name, stored_func_macro);
+  return unit;
+}
+
+// calls name with evaluated arguments like the vm does, args has room for the rest list after the last argument
+form_t aot_call(const char *name, int number_of_given_args, form_t *args)
+{
+  const FuncMacro *func_macro = get_func_macro(name);
+  if (func_macro == NULL)
+  {
+    const built_in_func_t *builtin = get_builtin(name);
+    if (builtin == NULL)
+      program_error("Error: unknown function %.*s\n", symbol_length(name), name);
+    return apply_builtin(name, builtin, number_of_given_args, args);
+  }
+  if (func_macro->is_macro)
+    program_error("Error: %.*s became a macro after the program was compiled\n", symbol_length(name), name);
+  assert_func_macro_arity(func_macro, number_of_given_args);
+  const int arity = func_macro->arity;
+  if (func_macro->rest_param != NULL)
+  {
+    const int number_of_rest_args = number_of_given_args - arity;
+    form_t rest = unit;
+    if (number_of_rest_args > 0)
+    {
+      form_t *rest_forms = gc_alloc_backing(number_of_rest_args, number_of_rest_args);
+      memcpy(rest_forms, args + arity, sizeof(form_t) * number_of_rest_args);
+      rest = (form_t){.tag = form_list, .len = number_of_rest_args, .forms = rest_forms};
+    }
+    args[arity] = rest;
+  }
+  return apply_func_macro(func_macro, args);
+}
+
+// prints the result of a compiled top-level form like run_form
+void aot_print(form_t result)
+{
+  print_form(result);
+  output_char('\n');
+  end_top_level_form();
+}
+
+// runs a top-level form the compiler left to the interpreter, definitions made again are not printed
+void aot_run_source(const char *text, bool print)
+{
+  FileLexerState st;
+  init_memory_lexer(&st, (char *)text, strlen(text));
+  const form_t form = parse(&st);
+  if (print)
+    run_form(form);
+  else
+  {
+    eval_top_level(compile(form, NULL));
+    end_top_level_form();
+  }
+}
+
+// the compiler
+// a func compiled to c, it is compiled again when a macro it expanded or a func it calls becomes a macro
+typedef struct
+{
+  const FuncMacro *func_macro;
+  char *text;
+  // names of the macros it expanded and the funcs it calls
+  const char **deps;
+  int n_deps;
+} aot_native_t;
+
+// words and list constants of the program are interned and parsed when it starts
+struct
+{
+  const char **words;
+  int n_words;
+  int cap_words;
+  form_t *constants;
+  int n_constants;
+  int cap_constants;
+  aot_native_t *natives;
+  int n_natives;
+  int cap_natives;
+  // names called by the function being compiled
+  const char **deps;
+  int n_deps;
+  int cap_deps;
+} aot_program = {0};
+
+typedef struct
+{
+  FILE *out;
+  int indent;
+  // first slot of each let/loop/parameter frame, innermost last
+  int *frames;
+  int n_frames;
+  int cap_frames;
+  int top;
+  int max_slots;
+  bool failed;
+} aot_compiler_t;
+
+// target of a cont in tail position
+typedef struct
+{
+  int first_slot;
+  int n_bindings;
+} aot_loop_t;
+
+int aot_word(const char *word)
+{
+  for (int i = 0; i < aot_program.n_words; i++)
+    if (aot_program.words[i] == word)
+      return i;
+  if (aot_program.n_words == aot_program.cap_words)
+  {
+    aot_program.cap_words = aot_program.cap_words == 0 ? 64 : aot_program.cap_words * 2;
+    aot_program.words = realloc(aot_program.words, sizeof(char *) * aot_program.cap_words);
+  }
+  aot_program.words[aot_program.n_words] = word;
+  return aot_program.n_words++;
+}
+
+int aot_constant(form_t form)
+{
+  if (aot_program.n_constants == aot_program.cap_constants)
+  {
+    aot_program.cap_constants = aot_program.cap_constants == 0 ? 64 : aot_program.cap_constants * 2;
+    aot_program.constants = realloc(aot_program.constants, sizeof(form_t) * aot_program.cap_constants);
+  }
+  // lists of the compiler may be in its transient region or its heap
+  aot_program.constants[aot_program.n_constants] = promote_form(&interp->permanent_arena, form);
+  return aot_program.n_constants++;
+}
+
+// the printed text of form, which parses back to an equal form as words only hold word characters
+char *aot_form_text(form_t form)
+{
+  char *text;
+  size_t len;
+  FILE *prev_out = interp->out;
+  FILE *text_out = open_memstream(&text, &len);
+  set_output(text_out);
+  print_form(form);
+  set_output(prev_out);
+  fclose(text_out);
+  return text;
+}
+
+void aot_line(aot_compiler_t *c, const char *format, ...)
+{
+  fprintf(c->out, "%*s", c->indent * 2, "");
+  va_list args;
+  va_start(args, format);
+  vfprintf(c->out, format, args);
+  va_end(args);
+  fputc('\n', c->out);
+}
+
+// a c expression of a word form of the program
+void aot_print_word(FILE *out, const char *word)
+{
+  fprintf(out, "(form_t){.tag = form_word, .len = %d, .word = aot_words[%d]}", symbol_length(word), aot_word(word));
+}
+
+int aot_alloc_slots(aot_compiler_t *c, int n)
+{
+  const int first = c->top;
+  c->top += n;
+  if (c->top > c->max_slots)
+    c->max_slots = c->top;
+  return first;
+}
+
+void aot_push_frame(aot_compiler_t *c, int first_slot)
+{
+  if (c->n_frames == c->cap_frames)
+  {
+    c->cap_frames = c->cap_frames == 0 ? 8 : c->cap_frames * 2;
+    c->frames = realloc(c->frames, sizeof(int) * c->cap_frames);
+  }
+  c->frames[c->n_frames++] = first_slot;
+}
+
+void aot_compile_node(aot_compiler_t *c, const node_t *node, int dst, const aot_loop_t *tail_loop);
+
+// returns a slot holding the value of node, variables are used in place
+int aot_compile_operand(aot_compiler_t *c, const node_t *node)
+{
+  if (node->kind == node_variable && node->variable.depth < c->n_frames)
+    return c->frames[c->n_frames - 1 - node->variable.depth] + node->variable.index;
+  const int slot = aot_alloc_slots(c, 1);
+  aot_compile_node(c, node, slot, NULL);
+  return slot;
+}
+
+void aot_compile_bodies(aot_compiler_t *c, int n, const node_t **bodies, int dst, const aot_loop_t *tail_loop)
+{
+  if (n == 0)
+  {
+    aot_line(c, "v[%d] = unit;", dst);
+    return;
+  }
+  for (int i = 0; i < n - 1; i++)
+  {
+    const int saved_top = c->top;
+    aot_compile_node(c, bodies[i], aot_alloc_slots(c, 1), NULL);
+    c->top = saved_top;
+  }
+  aot_compile_node(c, bodies[n - 1], dst, tail_loop);
+}
+
+// evaluates the arguments into consecutive slots followed by one for a rest list, returns the first
+int aot_compile_args(aot_compiler_t *c, int n, const node_t **args)
+{
+  const int first = aot_alloc_slots(c, n + 1);
+  for (int i = 0; i < n; i++)
+    aot_compile_node(c, args[i], first + i, NULL);
+  return first;
+}
+
+// the c operators of the builtins with a vm instruction, in vm_op order from op_add
+static const char *aot_int_operators[] = {"+", "-", "&", "|", "^", "==", "<", "<=", ">=", ">"};
+static const char *aot_int_builtins[] = {"bi_add", "bi_sub", "bi_bit_and", "bi_bit_or", "bi_bit_xor", "bi_eq", "bi_lt", "bi_le", "bi_ge", "bi_gt"};
+
+void aot_add_dep(const char *name)
+{
+  for (int i = 0; i < aot_program.n_deps; i++)
+    if (aot_program.deps[i] == name)
+      return;
+  if (aot_program.n_deps == aot_program.cap_deps)
+  {
+    aot_program.cap_deps = aot_program.cap_deps == 0 ? 16 : aot_program.cap_deps * 2;
+    aot_program.deps = realloc(aot_program.deps, sizeof(char *) * aot_program.cap_deps);
+  }
+  aot_program.deps[aot_program.n_deps++] = name;
+}
+
+void aot_compile_call(aot_compiler_t *c, const node_t *node, int dst, const aot_loop_t *tail_loop)
+{
+  const char *name = node->call.name;
+  const int n = node->call.n_args;
+  aot_add_dep(name);
+  const FuncMacro *func_macro = get_func_macro(name);
+  if (func_macro != NULL && func_macro->is_macro)
+  {
+    const node_t *expansion = node->call.expansion != NULL && node->call.expansion_epoch == interp->definition_epoch
+                                  ? node->call.expansion
+                                  : expand_call_site(node, func_macro);
+    aot_compile_node(c, expansion, dst, tail_loop);
+    return;
+  }
+  if (node->call.args == NULL && n > 0)
+  {
+    c->failed = true;
+    return;
+  }
+  const int saved_top = c->top;
+  const int word = aot_word(name);
+  if (func_macro == NULL && node->kind == node_builtin_call)
+  {
+    // a func defined later may shadow the builtin while the program runs
+    const vm_op op = vm_op_for_builtin(name);
+    const built_in_func_t *builtin = node->call.builtin;
+    if (op != 0 && n == 2)
+    {
+      const int a = aot_compile_operand(c, node->call.args[0]);
+      const int b = aot_compile_operand(c, node->call.args[1]);
+      const int first = aot_alloc_slots(c, n + 1);
+      aot_line(c, "if (interp->shadowed_builtins == 0 || get_func_macro(aot_words[%d]) == NULL)", word);
+      aot_line(c, "  v[%d] = %s(v[%d], v[%d], %s, %s);", dst, op >= op_eq ? "AOT_INT_CMP" : "AOT_INT_OP", a, b, aot_int_operators[op - op_add], aot_int_builtins[op - op_add]);
+      aot_line(c, "else");
+      aot_line(c, "{");
+      aot_line(c, "  v[%d] = v[%d];", first, a);
+      aot_line(c, "  v[%d] = v[%d];", first + 1, b);
+      aot_line(c, "  v[%d] = aot_call(aot_words[%d], 2, v + %d);", dst, word, first);
+      aot_line(c, "}");
+      c->top = saved_top;
+      return;
+    }
+    const int first = aot_compile_args(c, n, node->call.args);
+    const int index = (const built_in_func_entry_t *)((const char *)builtin - offsetof(built_in_func_entry_t, func)) - built_in_funcs;
+    aot_line(c, "if (interp->shadowed_builtins == 0 || get_func_macro(aot_words[%d]) == NULL)", word);
+    if (builtin->variadic)
+      aot_line(c, "  v[%d] = built_in_funcs[%d].func.funcvar(%d, v + %d);", dst, index, n, first);
+    else if (n == 0)
+      aot_line(c, "  v[%d] = built_in_funcs[%d].func.func0();", dst, index);
+    else if (n == 1)
+      aot_line(c, "  v[%d] = built_in_funcs[%d].func.func1(v[%d]);", dst, index, first);
+    else if (n == 2)
+      aot_line(c, "  v[%d] = built_in_funcs[%d].func.func2(v[%d], v[%d]);", dst, index, first, first + 1);
+    else
+      aot_line(c, "  v[%d] = built_in_funcs[%d].func.func3(v[%d], v[%d], v[%d]);", dst, index, first, first + 1, first + 2);
+    aot_line(c, "else");
+    aot_line(c, "  v[%d] = aot_call(aot_words[%d], %d, v + %d);", dst, word, n, first);
+    c->top = saved_top;
+    return;
+  }
+  const int first = aot_compile_args(c, n, node->call.args);
+  aot_line(c, "v[%d] = aot_call(aot_words[%d], %d, v + %d);", dst, word, n, first);
+  c->top = saved_top;
+}
+
+void aot_compile_node(aot_compiler_t *c, const node_t *node, int dst, const aot_loop_t *tail_loop)
+{
+  if (c->failed)
+    return;
+  switch (node->kind)
+  {
+  case node_constant:
+  {
+    const form_t constant = node->constant;
+    fprintf(c->out, "%*sv[%d] = ", c->indent * 2, "", dst);
+    if (constant.tag == form_int)
+      fprintf(c->out, "word_from_int(%d);\n", constant.number);
+    else if (constant.tag == form_word)
+    {
+      aot_print_word(c->out, constant.word);
+      fputs(";\n", c->out);
+    }
+    else if (constant.len == 0)
+      fputs("unit;\n", c->out);
+    else
+      fprintf(c->out, "aot_constants[%d];\n", aot_constant(constant));
+    return;
+  }
+  case node_variable:
+    if (node->variable.depth >= c->n_frames)
+    {
+      c->failed = true;
+      return;
+    }
+    aot_line(c, "v[%d] = v[%d];", dst, c->frames[c->n_frames - 1 - node->variable.depth] + node->variable.index);
+    return;
+  case node_unbound:
+    aot_line(c, "program_error(\"Error: word not found in env %.*s\\n\");", symbol_length(node->unbound), node->unbound);
+    return;
+  case node_if:
+  {
+    const int saved_top = c->top;
+    const int cond = aot_compile_operand(c, node->if_.cond);
+    c->top = saved_top;
+    aot_line(c, "if (!is_false(v[%d]))", cond);
+    aot_line(c, "{");
+    c->indent++;
+    aot_compile_node(c, node->if_.then, dst, tail_loop);
+    c->indent--;
+    aot_line(c, "}");
+    aot_line(c, "else");
+    aot_line(c, "{");
+    c->indent++;
+    aot_compile_node(c, node->if_.otherwise, dst, tail_loop);
+    c->indent--;
+    aot_line(c, "}");
+    return;
+  }
+  case node_let:
+  case node_loop:
+  {
+    const int saved_top = c->top;
+    const int n = node->let_loop.n_bindings;
+    const int first = aot_alloc_slots(c, n);
+    aot_push_frame(c, first);
+    for (int i = 0; i < n; i++)
+      aot_compile_node(c, node->let_loop.inits[i], first + i, NULL);
+    if (node->kind == node_let)
+      aot_compile_bodies(c, node->let_loop.n_bodies, node->let_loop.bodies, dst, tail_loop);
+    else
+    {
+      // a cont continues the c loop, any other value ends it
+      const aot_loop_t loop = {.first_slot = first, .n_bindings = n};
+      aot_line(c, "for (;;)");
+      aot_line(c, "{");
+      c->indent++;
+      aot_compile_bodies(c, node->let_loop.n_bodies, node->let_loop.bodies, dst, &loop);
+      aot_line(c, "break;");
+      c->indent--;
+      aot_line(c, "}");
+    }
+    c->n_frames--;
+    c->top = saved_top;
+    return;
+  }
+  case node_cont:
+  {
+    // like on the vm only a cont in tail position of a loop body is a jump, anything else is left to eval
+    if (tail_loop == NULL || tail_loop->n_bindings != node->cont.n_args)
+    {
+      c->failed = true;
+      return;
+    }
+    const int saved_top = c->top;
+    const int n = node->cont.n_args;
+    const int first = aot_compile_args(c, n, node->cont.args);
+    for (int i = 0; i < n; i++)
+      aot_line(c, "v[%d] = v[%d];", tail_loop->first_slot + i, first + i);
+    aot_line(c, "continue;");
+    c->top = saved_top;
+    return;
+  }
+  case node_builtin_call:
+  case node_call:
+  case node_macro_call:
+    aot_compile_call(c, node, dst, tail_loop);
+    return;
+  case node_malformed:
+  case node_definition:
+    c->failed = true;
+    return;
+  }
+  c->failed = true;
+}
+
+// writes a c function taking n_params parameter values and evaluating bodies to out, false if it cannot be compiled
+bool aot_compile_function(FILE *out, const char *c_name, int n_params, int n_bodies, const node_t **bodies)
+{
+  char *body;
+  size_t body_len;
+  aot_compiler_t c = {.out = open_memstream(&body, &body_len), .indent = 1};
+  aot_program.n_deps = 0;
+  if (n_params > 0)
+    aot_push_frame(&c, aot_alloc_slots(&c, n_params));
+  const int result = aot_alloc_slots(&c, 1);
+  aot_compile_bodies(&c, n_bodies, bodies, result, NULL);
+  fclose(c.out);
+  free(c.frames);
+  if (c.failed)
+  {
+    free(body);
+    return false;
+  }
+  fprintf(out, "static form_t %s(form_t *args)\n{\n", c_name);
+  fprintf(out, "  form_t v[%d];\n", c.max_slots);
+  if (n_params > 0)
+    fprintf(out, "  memcpy(v, args, sizeof(form_t) * %d);\n", n_params);
+  else
+    fprintf(out, "  (void)args;\n");
+  // the collector only looks at the tag of a slot not written yet
+  fprintf(out, "  for (int i = %d; i < %d; i++)\n    v[i].tag = 0;\n", n_params, c.max_slots);
+  fprintf(out, "  gc_push_roots(v, %d);\n", c.max_slots);
+  fwrite(body, 1, body_len, out);
+  fprintf(out, "  gc_pop_roots();\n  return v[%d];\n}\n\n", result);
+  free(body);
+  return true;
+}
+
+// a c identifier for the function of the top-level form index
+char *aot_c_name(const char *kind, int index, const char *name)
+{
+  const int len = name == NULL ? 0 : symbol_length(name);
+  char *c_name = malloc(strlen(kind) + len + 32);
+  int k = sprintf(c_name, "aot_%s_%d", kind, index);
+  if (name != NULL)
+  {
+    c_name[k++] = '_';
+    for (int i = 0; i < len; i++)
+      c_name[k++] = (name[i] >= 'a' && name[i] <= 'z') || (name[i] >= '0' && name[i] <= '9') ? name[i] : '_';
+    c_name[k] = '\0';
+  }
+  return c_name;
+}
+
+void aot_print_string(FILE *out, const char *s)
+{
+  // word characters, spaces and brackets need no escapes
+  fprintf(out, "\"%s\"", s);
+}
+
+// compiles a func to the c function c_name and emits the statement defining it, false if it cannot be compiled
+bool aot_compile_func(FILE *functions_out, FILE *main_out, const FuncMacro *func_macro, const char *c_name, const char *text, bool print)
+{
+  const int n_params = func_macro->arity + (func_macro->rest_param == NULL ? 0 : 1);
+  if (!aot_compile_function(functions_out, c_name, n_params, func_macro->n_of_bodies, func_macro_body_nodes(func_macro)))
+    return false;
+  fprintf(main_out, print ? "  aot_print(aot_define(aot_words[%d], %d, " : "  aot_define(aot_words[%d], %d, ", aot_word(func_macro->name), func_macro->arity);
+  if (func_macro->rest_param == NULL)
+    fputs("NULL", main_out);
+  else
+    fprintf(main_out, "aot_words[%d]", aot_word(func_macro->rest_param));
+  fprintf(main_out, print ? ", %s));\n" : ", %s);\n", c_name);
+  int i = 0;
+  while (i < aot_program.n_natives && aot_program.natives[i].func_macro != func_macro)
+    i++;
+  if (i == aot_program.n_natives)
+  {
+    if (aot_program.n_natives == aot_program.cap_natives)
+    {
+      aot_program.cap_natives = aot_program.cap_natives == 0 ? 64 : aot_program.cap_natives * 2;
+      aot_program.natives = realloc(aot_program.natives, sizeof(aot_native_t) * aot_program.cap_natives);
+    }
+    aot_program.natives[aot_program.n_natives++] = (aot_native_t){.func_macro = func_macro, .text = strdup(text)};
+  }
+  aot_native_t *native = &aot_program.natives[i];
+  free(native->deps);
+  native->deps = malloc(sizeof(char *) * (aot_program.n_deps + 1));
+  memcpy(native->deps, aot_program.deps, sizeof(char *) * aot_program.n_deps);
+  native->n_deps = aot_program.n_deps;
+  return true;
+}
+
+// a macro named name was defined, compiled funcs that expanded the previous macro or call name are stale
+// with name NULL a definition moved the epoch, a func that expanded any macro may be stale as the macro may call it
+// they are compiled again with the definitions at this point, which is when eval would expand them again
+void aot_recompile_dependents(FILE *functions_out, FILE *main_out, const char *name, int index)
+{
+  for (int i = 0; i < aot_program.n_natives; i++)
+  {
+    aot_native_t *native = &aot_program.natives[i];
+    if (native->func_macro == NULL)
+      continue;
+    if (get_func_macro(native->func_macro->name) != native->func_macro)
+    {
+      native->func_macro = NULL;
+      continue;
+    }
+    bool depends = false;
+    for (int j = 0; j < native->n_deps; j++)
+    {
+      const FuncMacro *dep = get_func_macro(native->deps[j]);
+      depends |= name == NULL ? dep != NULL && dep->is_macro : native->deps[j] == name;
+    }
+    if (!depends)
+      continue;
+    char *c_name = aot_c_name("refunc", index, native->func_macro->name);
+    if (!aot_compile_func(functions_out, main_out, native->func_macro, c_name, native->text, false))
+    {
+      fputs("  aot_run_source(", main_out);
+      aot_print_string(main_out, native->text);
+      fputs(", false);\n", main_out);
+      native->func_macro = NULL;
+    }
+    free(c_name);
+  }
+}
+
+// compiles the top-level forms of st into a c program in out_filename
+void emit_c(FileLexerState *st, const char *source_name, const char *out_filename)
+{
+  char *functions, *statements;
+  size_t functions_len, statements_len;
+  FILE *functions_out = open_memstream(&functions, &functions_len);
+  FILE *main_out = open_memstream(&statements, &statements_len);
+  int index = 0;
+  int n_native = 0;
+  int c;
+  while ((st->tok = st->cur, c = peek_char(st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
+    {
+      skip_run(st, WHITESPACE);
+      continue;
+    }
+    const form_t form = parse(st);
+    char *text = aot_form_text(form);
+    fprintf(main_out, "  // %.*s%s\n", 100, text, strlen(text) > 100 ? "..." : "");
+    const node_t *node = compile(form, NULL);
+    // a top-level macro call expanding to a definition is a definition
+    while (node->kind == node_macro_call && get_func_macro(node->call.name) != NULL && get_func_macro(node->call.name)->is_macro)
+      node = expand_call_site(node, get_func_macro(node->call.name));
+    bool compiled = false;
+    if (node->kind == node_definition)
+    {
+      // later macro calls are expanded with the definitions before them like at run time
+      const FuncMacro *previous = get_func_macro(node->definition.name);
+      const int epoch = interp->definition_epoch;
+      eval_definition(node);
+      const FuncMacro *func_macro = get_func_macro(node->definition.name);
+      char *c_name = aot_c_name("func", index, func_macro->name);
+      compiled = !func_macro->is_macro && aot_compile_func(functions_out, main_out, func_macro, c_name, text, true);
+      free(c_name);
+      if (!compiled)
+      {
+        fputs("  aot_run_source(", main_out);
+        aot_print_string(main_out, text);
+        fputs(", true);\n", main_out);
+      }
+      if (func_macro->is_macro || (previous != NULL && previous->is_macro))
+        aot_recompile_dependents(functions_out, main_out, func_macro->name, index);
+      else if (interp->definition_epoch != epoch)
+        aot_recompile_dependents(functions_out, main_out, NULL, index);
+    }
+    else
+    {
+      char *c_name = aot_c_name("form", index, NULL);
+      compiled = aot_compile_function(functions_out, c_name, 0, 1, &node);
+      if (compiled)
+        fprintf(main_out, "  aot_print(%s(NULL));\n", c_name);
+      else
+      {
+        fputs("  aot_run_source(", main_out);
+        aot_print_string(main_out, text);
+        fputs(", true);\n", main_out);
+      }
+      free(c_name);
+    }
+    if (compiled)
+      n_native++;
+    free(text);
+    end_top_level_form();
+    index++;
+  }
+  fclose(functions_out);
+  fclose(main_out);
+  FILE *out = fopen(out_filename, "w");
+  if (out == NULL)
+  {
+    printf("Error: could not open %s\n", out_filename);
+    exit(1);
+  }
+  fprintf(out, "// compiled from %s by uns --emit-c, build it with the directory of lexer.c on the include path\n", source_name);
+  fprintf(out, "#define UNS_NO_MAIN\n#include \"lexer.c\"\n\n");
+  fprintf(out, "static const char *const aot_word_texts[] = {");
+  for (int i = 0; i < aot_program.n_words; i++)
+  {
+    fputs(i % 8 == 0 ? "\n    " : " ", out);
+    fprintf(out, "\"%.*s\",", symbol_length(aot_program.words[i]), aot_program.words[i]);
+  }
+  fprintf(out, "\n    NULL};\nstatic const char *aot_words[%d];\n", aot_program.n_words + 1);
+  fprintf(out, "static const char *const aot_constant_texts[] = {\n");
+  for (int i = 0; i < aot_program.n_constants; i++)
+  {
+    char *text = aot_form_text(aot_program.constants[i]);
+    fputs("    ", out);
+    aot_print_string(out, text);
+    fputs(",\n", out);
+    free(text);
+  }
+  fprintf(out, "    NULL};\nstatic form_t aot_constants[%d];\n\n", aot_program.n_constants + 1);
+  fwrite(functions, 1, functions_len, out);
+  fprintf(out, "int main(int argc, char **argv)\n{\n  (void)argv;\n");
+  fprintf(out, "  aot_start((const char *)&argc);\n");
+  fprintf(out, "  aot_intern_words(aot_words, aot_word_texts, %d);\n", aot_program.n_words);
+  fprintf(out, "  aot_parse_constants(aot_constants, aot_constant_texts, %d);\n", aot_program.n_constants);
+  fwrite(statements, 1, statements_len, out);
+  fprintf(out, "  return 0;\n}\n");
+  fclose(out);
+  free(functions);
+  free(statements);
+  fprintf(stderr, "%d of %d top-level forms compiled to c, the others are evaluated from their source\n", n_native, index);
+}
+
+// --batch runs every file in an interpreter of its own on a pool of threads, each worker resets its interpreter between files
+// outputs are buffered and printed in the order of the files as if they were run one after the other
+typedef struct
+{
+  const char *filename;
+  char *output;
+  size_t output_len;
+  // stopped with an error
+  bool failed;
+  bool done;
+} batch_file_t;
+
+// the files left to a worker, it takes them from next while idle workers steal from end
+typedef struct
+{
+  pthread_mutex_t lock;
+  int next;
+  int end;
+} batch_queue_t;
+
+struct
+{
+  batch_file_t *files;
+  batch_queue_t *queues;
+  int n_queues;
+  pthread_mutex_t done_lock;
+  pthread_cond_t done_cond;
+} batch = {.files = NULL, .queues = NULL, .n_queues = 0, .done_lock = PTHREAD_MUTEX_INITIALIZER, .done_cond = PTHREAD_COND_INITIALIZER};
+
+// the index of the next file for worker, -1 when all files are taken
+int batch_take(int worker)
+{
+  for (int k = 0; k < batch.n_queues; k++)
+  {
+    batch_queue_t *queue = &batch.queues[(worker + k) % batch.n_queues];
+    int index = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next < queue->end)
+      index = k == 0 ? queue->next++ : --queue->end;
+    pthread_mutex_unlock(&queue->lock);
+    if (index >= 0)
+      return index;
+  }
+  return -1;
+}
+
+void batch_run_file(batch_file_t *batch_file)
+{
+  FILE *out = open_memstream(&batch_file->output, &batch_file->output_len);
+  interp_reset(out);
+  define_image();
+  FILE *file = fopen(batch_file->filename, "r");
+  if (file == NULL)
+  {
+    fprintf(out, "Error: could not open file\n");
+    batch_file->failed = true;
+  }
+  else
+  {
+    FileLexerState st;
+    if (!init_mapped_lexer(&st, file))
+      init_lexer(&st, file);
+    // the symbol table outlives the file
+    st.copy_words = true;
+    // an error stops this file like it would stop the process running it alone
+    jmp_buf on_error;
+    interp->on_error = &on_error;
+    if (setjmp(on_error) == 0)
+    {
+      run_prelude();
+      if (ast_cache && st.mapped)
+        run_cached_forms(&st, batch_file->filename, true);
+      else
+        run_forms(&st);
+    }
+    else
+      batch_file->failed = true;
+    interp->on_error = NULL;
+    close_lexer(&st);
+    fclose(file);
+  }
+  flush_output();
+  fclose(out);
+  pthread_mutex_lock(&batch.done_lock);
+  batch_file->done = true;
+  pthread_cond_broadcast(&batch.done_cond);
+  pthread_mutex_unlock(&batch.done_lock);
+}
+
+void *batch_worker(void *arg)
+{
+  const int worker = (intptr_t)arg;
+  interp_t worker_interp;
+  interp_init(&worker_interp, NULL);
+  init_native_stack((const char *)&worker_interp);
+  for (int index; (index = batch_take(worker)) >= 0;)
+    batch_run_file(&batch.files[index]);
+  interp_free();
+  return NULL;
+}
 
-    {"at", {.parameters = 2, .func2 = bi_at}},
-    {"word-from-codepoints", {.parameters = 1, .func1 = bi_word_from_codepoints}},
+// returns the exit status, 1 if any file stopped with an error
+int run_batch(int n_files, const char **filenames, int jobs)
+{
+  if (jobs > n_files)
+    jobs = n_files;
+  batch.files = calloc(n_files, sizeof(batch_file_t));
+  for (int i = 0; i < n_files; i++)
+    batch.files[i].filename = filenames[i];
+  // each worker starts with a contiguous share of the files
+  batch.n_queues = jobs;
+  batch.queues = malloc(sizeof(batch_queue_t) * jobs);
+  for (int k = 0; k < jobs; k++)
+  {
+    pthread_mutex_init(&batch.queues[k].lock, NULL);
+    batch.queues[k].next = (long)n_files * k / jobs;
+    batch.queues[k].end = (long)n_files * (k + 1) / jobs;
+  }
+  symbol_table_shared = true;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, native_stack_size());
+  pthread_t *threads = malloc(sizeof(pthread_t) * jobs);
+  for (int k = 0; k < jobs; k++)
+    if (pthread_create(&threads[k], &attr, batch_worker, (void *)(intptr_t)k) != 0)
+    {
+      printf("Error: could not start worker thread\n");
+      exit(1);
+    }
+  pthread_attr_destroy(&attr);
+  int status = 0;
+  for (int i = 0; i < n_files; i++)
+  {
+    batch_file_t *batch_file = &batch.files[i];
+    pthread_mutex_lock(&batch.done_lock);
+    while (!batch_file->done)
+      pthread_cond_wait(&batch.done_cond, &batch.done_lock);
+    pthread_mutex_unlock(&batch.done_lock);
+    fwrite(batch_file->output, 1, batch_file->output_len, stdout);
+    free(batch_file->output);
+    if (batch_file->failed)
+      status = 1;
+  }
+  for (int k = 0; k < jobs; k++)
+    pthread_join(threads[k], NULL);
+  free(threads);
+  return status;
+}
 
-    {"slice", {.parameters = 3, .func3 = bi_slice}},
+// --serve=<socket> evaluates requests on a unix socket with the image and prelude loaded once
+// a request is a line of forms, its response is what running them prints followed by an empty line, so clients can pipeline requests
+// definitions a request makes are undone after it, see definitions_checkpoint_t
+typedef struct
+{
+  int fd;
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+  char *out;
+  size_t out_len;
+  size_t out_cap;
+  size_t out_sent;
+  // the client sent everything, it is closed once its output is sent
+  bool eof;
+} serve_client_t;
 
-    {"concat", {.parameters = 0, .variadic = true, .funcvar = bi_concat}},
-};
+// latencies in ns are counted in buckets a sixteenth of their power of two wide, percentiles are within about 6%
+#define SERVE_LATENCY_BUCKETS (64 * 16)
+// a client is not read from while this much of its output is unsent
+#define SERVE_MAX_PENDING_OUTPUT (1 << 20)
+
+struct
+{
+  uint64_t latency_counts[SERVE_LATENCY_BUCKETS];
+  uint64_t requests;
+  uint64_t max_latency_ns;
+  uint64_t failed;
+  volatile sig_atomic_t stop;
+} serve_stats;
 
-built_in_func_t get_builtin(const char *name)
+int serve_latency_bucket(uint64_t ns)
 {
-  for (size_t i = 0; i < sizeof(built_in_funcs) / sizeof(built_in_func_entry_t); i++)
-    if (streq(name, built_in_funcs[i].name))
-      return built_in_funcs[i].func;
-  return (built_in_func_t){.parameters = -1};
+  if (ns < 16)
+    return ns;
+  const int exponent = 63 - __builtin_clzll(ns);
+  return (exponent - 3) * 16 + ((ns >> (exponent - 4)) & 15);
 }
 
-typedef struct
+uint64_t serve_bucket_latency(int bucket)
 {
-  const char *word;
-  form_t form;
-} Binding;
+  if (bucket < 16)
+    return bucket;
+  return (uint64_t)(16 + bucket % 16) << (bucket / 16 - 1);
+}
 
-typedef struct Env
+uint64_t serve_latency_percentile(double p)
 {
-  const struct Env *parent;
-  int len;
-  const Binding *bindings;
-} Env_t;
+  const uint64_t rank = (uint64_t)(p * serve_stats.requests);
+  uint64_t seen = 0;
+  for (int i = 0; i < SERVE_LATENCY_BUCKETS; i++)
+  {
+    seen += serve_stats.latency_counts[i];
+    if (seen > rank)
+      return serve_bucket_latency(i);
+  }
+  return serve_stats.max_latency_ns;
+}
+
+void print_serve_stats()
+{
+  fprintf(stderr, "serve: %" PRIu64 " requests, %" PRIu64 " stopped by an error\n", serve_stats.requests, serve_stats.failed);
+  if (serve_stats.requests == 0)
+    return;
+  fprintf(stderr, "serve: latency p50 %.1f us p90 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n", serve_latency_percentile(0.5) / 1e3,
+          serve_latency_percentile(0.9) / 1e3, serve_latency_percentile(0.99) / 1e3, serve_latency_percentile(0.999) / 1e3, serve_stats.max_latency_ns / 1e3);
+}
 
-void print_env(const Env_t *env)
+void serve_on_signal(int signal)
 {
-  while (env != NULL)
+  (void)signal;
+  serve_stats.stop = 1;
+}
+
+void serve_append(char **buffer, size_t *len, size_t *cap, const char *data, size_t n)
+{
+  if (*len + n > *cap)
   {
-    for (int i = 0; i < env->len; i++)
-    {
-      printf("print_env: %s: ", env->bindings[i].word);
-      print_form(env->bindings[i].form);
-      printf("\n");
-    }
-    env = env->parent;
+    while (*len + n > *cap)
+      *cap = *cap == 0 ? 4096 : *cap * 2;
+    *buffer = realloc(*buffer, *cap);
   }
+  memcpy(*buffer + *len, data, n);
+  *len += n;
 }
 
+// what requests print goes to a memory stream that is rewound for each request
 typedef struct
 {
-  const bool is_macro;
-  const int arity;
-  const char **parameters;
-  const char *rest_param;
-  const int n_of_bodies;
-  const form_t *bodies;
-} FuncMacro;
+  FILE *file;
+  char *data;
+  size_t len;
+} serve_output_t;
 
-typedef struct
+// runs the forms of one request line with its output going to out
+void serve_request(char *line, size_t len, FILE *out, definitions_checkpoint_t *checkpoint)
 {
-  const char *name;
-  const FuncMacro func_macro;
-} FuncMacroBinding;
+  FileLexerState st;
+  init_memory_lexer(&st, line, len);
+  // the symbol table outlives the line
+  st.copy_words = true;
+  set_output(out);
+  interp->checkpoint = checkpoint;
+  jmp_buf on_error;
+  interp->on_error = &on_error;
+  if (setjmp(on_error) == 0)
+    run_forms(&st);
+  else
+  {
+    interp_unwind();
+    end_top_level_form();
+    serve_stats.failed++;
+  }
+  interp->on_error = NULL;
+  interp->checkpoint = NULL;
+  flush_output();
+  restore_definitions(checkpoint);
+}
 
-typedef struct
+// answers the complete lines client sent so far
+void serve_client_input(serve_client_t *client, serve_output_t *output, definitions_checkpoint_t *checkpoint)
 {
-  int len;
-  FuncMacroBinding *bindings;
-} FuncMacroEnv;
+  size_t start = 0;
+  char *newline;
+  while (client->out_len - client->out_sent < SERVE_MAX_PENDING_OUTPUT &&
+         (newline = memchr(client->in + start, '\n', client->in_len - start)) != NULL)
+  {
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    rewind(output->file);
+    serve_request(client->in + start, newline - (client->in + start), output->file, checkpoint);
+    fputc('\n', output->file);
+    fflush(output->file);
+    serve_append(&client->out, &client->out_len, &client->out_cap, output->data, ftell(output->file));
+    const uint64_t ns = seconds_since(&begin) * 1e9;
+    serve_stats.latency_counts[serve_latency_bucket(ns)]++;
+    serve_stats.requests++;
+    if (ns > serve_stats.max_latency_ns)
+      serve_stats.max_latency_ns = ns;
+    start = newline + 1 - client->in;
+  }
+  memmove(client->in, client->in + start, client->in_len - start);
+  client->in_len -= start;
+}
 
-FuncMacroEnv func_macro_env = {
-    .len = 0,
-    .bindings = NULL,
-};
+// writes what it can of the pending output of client, false if the client is gone
+bool serve_client_flush(serve_client_t *client)
+{
+  while (client->out_sent < client->out_len)
+  {
+    const ssize_t n = write(client->fd, client->out + client->out_sent, client->out_len - client->out_sent);
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    client->out_sent += n;
+  }
+  client->out_len = client->out_sent = 0;
+  return true;
+}
 
-void insert_func_macro_binding(FuncMacroBinding b)
+// reads what client sent and answers its complete lines, false if the client is gone or done
+bool serve_client_read(serve_client_t *client, serve_output_t *output, definitions_checkpoint_t *checkpoint)
 {
-  // todo handle overwriting properly
-  FuncMacroBinding *new_bindings = realloc(func_macro_env.bindings, sizeof(FuncMacroBinding) * (func_macro_env.len + 1));
-  memcpy(&new_bindings[func_macro_env.len], &b, sizeof(FuncMacroBinding));
-  func_macro_env.len++;
-  func_macro_env.bindings = new_bindings;
+  if (client->in_cap - client->in_len < 4096)
+  {
+    client->in_cap = client->in_cap == 0 ? 16384 : client->in_cap * 2;
+    client->in = realloc(client->in, client->in_cap);
+  }
+  const ssize_t n = read(client->fd, client->in + client->in_len, client->in_cap - client->in_len);
+  if (n == 0)
+  {
+    client->eof = true;
+    return client->out_len > client->out_sent;
+  }
+  if (n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  client->in_len += n;
+  serve_client_input(client, output, checkpoint);
+  return serve_client_flush(client);
 }
 
-const FuncMacro *get_func_macro(const char *name)
+void serve_client_close(serve_client_t *client)
 {
-  // search from the end to the beginning to get the latest definition
-  for (int i = func_macro_env.len - 1; i >= 0; i--)
-    if (streq(name, func_macro_env.bindings[i].name))
-      return &func_macro_env.bindings[i].func_macro;
-  return NULL;
+  close(client->fd);
+  free(client->in);
+  free(client->out);
 }
 
-form_t eval(form_t form, const Env_t *env)
+// serves requests on a unix socket at path until SIGINT or SIGTERM, one interpreter answers them in turn
+int serve(const char *path)
 {
-  if (is_word(form))
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (listen_fd < 0 || strlen(path) >= sizeof(address.sun_path))
+  {
+    printf("Error: could not make a socket at %s\n", path);
+    return 1;
+  }
+  strcpy(address.sun_path, path);
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 128) != 0)
+  {
+    printf("Error: could not listen on %s\n", path);
+    return 1;
+  }
+  fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+  struct sigaction action = {.sa_handler = serve_on_signal};
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  serve_output_t output = {0};
+  output.file = open_memstream(&output.data, &output.len);
+  definitions_checkpoint_t checkpoint = {0};
+  serve_client_t *clients = NULL;
+  struct pollfd *fds = NULL;
+  int n_clients = 0;
+  int cap_clients = 0;
+  fprintf(stderr, "serving on %s\n", path);
+  while (!serve_stats.stop)
   {
-    const char *word = form.word;
-    Env_t *cur_env = (Env_t *)env;
-    while (cur_env != NULL)
+    if (n_clients + 1 > cap_clients)
     {
-      for (int i = 0; i < cur_env->len; i++)
-        if (streq(word, cur_env->bindings[i].word))
-          return cur_env->bindings[i].form;
-      cur_env = (Env_t *)cur_env->parent;
+      cap_clients = cap_clients == 0 ? 16 : cap_clients * 2;
+      clients = realloc(clients, sizeof(serve_client_t) * cap_clients);
+      fds = realloc(fds, sizeof(struct pollfd) * (cap_clients + 1));
     }
-    // to do proper error handling
-    printf("Error: word not found in env %s\n", word);
-    exit(1);
-  }
-  assert(is_list(form) && "eval requires a list at this point");
-
-  const int length = form.len;
-  if (length == 0)
-    return unit;
-  const form_t *forms = form.forms;
-  const form_t first = forms[0];
-  assert(is_word(first) && "first element a list must be a word");
-  const char *first_word = first.word;
-  if (streq(first_word, "quote"))
-  {
-    assert(length == 2 && "quote takes exactly one argument");
-    return forms[1];
-  }
-  if (streq(first_word, "if"))
-  {
-    assert(length == 4 && "if takes three arguments");
-    const form_t cond = eval(forms[1], env);
-    bool b = is_word(cond) &&
-             cond.len == 1 &&
-             cond.word[0] == '0';
-    return eval(forms[b ? 3 : 2], env);
-  }
-  bool is_let = streq(first_word, "let");
-  bool is_loop = streq(first_word, "loop");
-  if (is_let || is_loop)
-  {
-    assert(length >= 2 && "let/loop must have at least two arguments");
-    form_t binding_form = forms[1];
-    assert(is_list(binding_form) && "let/loop and loop bindings must be a list");
-    const int binding_length = binding_form.len;
-    assert(binding_length % 2 == 0 && "let/loop bindings must be a list of even length");
-    const form_t *binding_forms = binding_form.forms;
-    const int number_of_bindings = binding_length / 2;
-    Binding *bindings = number_of_bindings == 0 ? NULL : malloc(sizeof(Binding) * number_of_bindings);
-    Env_t new_env = {.parent = env, .len = 0, .bindings = bindings};
-    for (int i = 0; i < binding_length; i += 2)
-    {
-      assert(is_word(binding_forms[i]) && "let/loop bindings must be words");
-      bindings[new_env.len].word = binding_forms[i].word;
-      bindings[new_env.len].form = eval(binding_forms[i + 1], &new_env);
-      new_env.len++;
-    }
-    if (is_let)
-    {
-      form_t result = unit;
-      for (int i = 2; i < length; i++)
-        result = eval(forms[i], &new_env);
-      free(bindings);
-      return result;
+    fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+    for (int i = 0; i < n_clients; i++)
+    {
+      const size_t pending = clients[i].out_len - clients[i].out_sent;
+      const bool reading = !clients[i].eof && pending < SERVE_MAX_PENDING_OUTPUT;
+      fds[i + 1] = (struct pollfd){.fd = clients[i].fd, .events = (reading ? POLLIN : 0) | (pending > 0 ? POLLOUT : 0)};
     }
-    while (true)
+    if (poll(fds, n_clients + 1, -1) < 0)
+      continue;
+    // clients are compacted in place, fds keeps the order they had when polled
+    int kept = 0;
+    for (int i = 0; i < n_clients; i++)
     {
-      form_t result = unit;
-      for (int i = 2; i < length; i++)
-        result = eval(forms[i], &new_env);
-      if (is_list(result) &&
-          result.len > 0 &&
-          streq(result.forms[0].word, continueSpecialWord.word))
+      serve_client_t *client = &clients[i];
+      const short revents = fds[i + 1].revents;
+      bool alive = true;
+      if (revents & POLLOUT)
       {
-        assert(result.len - 1 == number_of_bindings && "loop bindings mismatch");
-        for (int i = 0; i < number_of_bindings; i++)
+        alive = serve_client_flush(client);
+        // lines held back while the output was full
+        if (alive && client->out_len - client->out_sent < SERVE_MAX_PENDING_OUTPUT)
         {
-          const form_t v = result.forms[i + 1];
-          bindings[i].form = v;
+          serve_client_input(client, &output, &checkpoint);
+          alive = serve_client_flush(client);
         }
-        free(result.forms);
-        continue;
+        alive = alive && !(client->eof && client->out_len == client->out_sent);
       }
-      free(bindings);
-      return result;
+      if (alive && !client->eof && (revents & (POLLIN | POLLHUP)))
+        alive = serve_client_read(client, &output, &checkpoint);
+      else if (revents & (POLLERR | POLLNVAL))
+        alive = false;
+      if (alive)
+        clients[kept++] = *client;
+      else
+        serve_client_close(client);
     }
-  }
-  if (streq(first_word, "cont"))
-  {
-    form_t *cont_args = malloc(sizeof(form_t) * (length));
-    cont_args[0] = continueSpecialWord;
-    for (int i = 1; i < length; i++)
-      cont_args[i] = eval(forms[i], env);
-    return (form_t){.tag = form_list, .len = length, .forms = cont_args};
-  }
-  {
-    const bool is_func = streq(first_word, "func");
-    const bool is_macro = streq(first_word, "macro");
-    if (is_func || is_macro)
+    n_clients = kept;
+    if (fds[0].revents & POLLIN)
     {
-      assert(length >= 3 && "func/macro must have at least two arguments");
-      const form_t fname = forms[1];
-      assert(is_word(fname) && "func/macro name must be a word");
-      const form_t params = forms[2];
-      assert(is_list(params) && "func/macro params must be a list");
-      const int param_length = params.len;
-      for (int i = 0; i < param_length; i++)
-      {
-        assert(is_word(params.forms[i]) && "func/macro params must be words");
-      }
-      const char *rest_param = NULL;
-      int arity;
-      if (param_length >= 2 && streq(params.forms[param_length - 2].word, ".."))
-      {
-        rest_param = params.forms[param_length - 1].word;
-        arity = param_length - 2;
-      }
-      else
+      int fd;
+      while (n_clients < cap_clients && (fd = accept(listen_fd, NULL, NULL)) >= 0)
       {
-        arity = param_length;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        clients[n_clients++] = (serve_client_t){.fd = fd};
       }
-      const char **parameters = malloc(arity * sizeof(char *));
-      for (int i = 0; i < arity; i++)
-        parameters[i] = params.forms[i].word;
-      form_t *bodies = malloc(sizeof(form_t) * (length - 3));
-      for (int i = 3; i < length; i++)
-        bodies[i - 3] = forms[i];
-      FuncMacro func_macro = {
-          .is_macro = is_macro,
-          .arity = arity,
-          .parameters = parameters,
-          .rest_param = rest_param,
-          .n_of_bodies = length - 3,
-          .bodies = bodies,
-      };
-      FuncMacroBinding func_macro_binding = {.name = fname.word, .func_macro = func_macro};
-      insert_func_macro_binding(func_macro_binding);
-      {
-        const FuncMacro *test_func_macro = get_func_macro(fname.word);
-        assert(test_func_macro != NULL && "func/macro not found");
-        assert(test_func_macro->arity == arity && "func/macro arity mismatch");
-      }
-      return unit;
     }
   }
+  for (int i = 0; i < n_clients; i++)
+    serve_client_close(&clients[i]);
+  free(clients);
+  free(fds);
+  fclose(output.file);
+  free(output.data);
+  close(listen_fd);
+  unlink(path);
+  set_output(stdout);
+  print_serve_stats();
+  return 0;
+}
 
-  const int number_of_given_args = length - 1;
-  const FuncMacro *func_macro = get_func_macro(first_word);
-  if (func_macro == NULL)
+// --watch runs a file, then polls it and runs it again whenever it changes, evaluating as little of it as it can
+// a top-level form is known by a hash of its text and keeps what it printed, the names it looked up and the names it defined
+// after a change the forms with new text are evaluated, and the forms that looked up a name whose definition changed
+// the other forms print what they printed before, what the incremental run cannot tell apart from a full run falls back to one
+// gensym numbers can differ from a full run as the forms that make them are not all evaluated again
+#define WATCH_POLL_MS 100
+
+typedef struct
+{
+  uint64_t hash;
+  // the text of the form in the current source
+  size_t offset;
+  size_t len;
+  // name of a [func name ..] or [macro name ..] form, known before it is evaluated
+  const char *syntactic_name;
+  // the form of the previous run with the same text, -1 for new text
+  int previous;
+  bool dirty;
+  // false when it stopped with an error or an earlier form did
+  bool complete;
+  char *output;
+  size_t output_len;
+  const char **lookups;
+  int n_lookups;
+  const char **definitions;
+  int n_definitions;
+} watch_form_t;
+
+typedef struct
+{
+  watch_form_t *forms;
+  int n_forms;
+  // forms up to the one that stopped with an error, or all of them
+  int n_reached;
+  // names with a builtin or a definition of the image or prelude, changing them needs a full run
+  name_map_t base_names;
+  // the program defines a name twice, which only a full run evaluates in the right order
+  bool needs_full_run;
+  // where forms print, rewound for each of them
+  FILE *capture;
+  char *capture_data;
+  size_t capture_len;
+} watch_state_t;
+
+void watch_free_form(watch_form_t *form)
+{
+  free(form->output);
+  free(form->lookups);
+  free(form->definitions);
+  form->output = NULL;
+  form->lookups = form->definitions = NULL;
+  form->output_len = 0;
+  form->n_lookups = form->n_definitions = 0;
+}
+
+// parses the form of st at form->offset into text and finds its length and the name it defines syntactically
+// false if it stopped with a parse error, guarded apart from watch_scan so no local of the scan lives across setjmp
+bool watch_parse(FileLexerState *st, const char *text, watch_form_t *form)
+{
+  jmp_buf on_error;
+  interp->on_error = &on_error;
+  if (setjmp(on_error) != 0)
   {
-    const built_in_func_t builtin = get_builtin(first_word);
-    if (builtin.parameters == -1)
+    interp->on_error = NULL;
+    interp_unwind();
+    return false;
+  }
+  const form_t parsed = parse(st);
+  interp->on_error = NULL;
+  form->len = st->cur - text - form->offset;
+  const form_t *items = form_items(parsed);
+  if (parsed.tag == form_list && parsed.len >= 2 && items[0].tag == form_word && (items[0].word == sym_func || items[0].word == sym_macro) &&
+      items[1].tag == form_word)
+    form->syntactic_name = items[1].word;
+  return true;
+}
+
+// splits text into top-level forms, a parse error makes the rest of text one form that stops with it when evaluated
+watch_form_t *watch_scan(watch_state_t *w, char *text, size_t size, int *n_forms)
+{
+  FileLexerState st;
+  init_memory_lexer(&st, text, size);
+  st.copy_words = true;
+  watch_form_t *forms = NULL;
+  int n = 0;
+  int cap = 0;
+  // parse errors print
+  set_output(w->capture);
+  int c;
+  while ((st.tok = st.cur, c = peek_char(&st)) >= 0)
+  {
+    if (classify_char(c) == WHITESPACE)
     {
-      printf("Error: unknown function %s\n", first_word);
-      exit(1);
+      skip_run(&st, WHITESPACE);
+      continue;
     }
-    assert(builtin.parameters >= 0 && "builtin not found");
-    if (builtin.variadic)
+    if (n == cap)
     {
-      form_t *args = malloc(sizeof(form_t) * number_of_given_args);
-      for (int i = 1; i < length; i++)
-        args[i - 1] = eval(forms[i], env);
-      const form_t res = builtin.funcvar(number_of_given_args, args);
-      free(args);
-      return res;
+      cap = cap == 0 ? 64 : cap * 2;
+      forms = realloc(forms, sizeof(watch_form_t) * cap);
     }
-    assert(builtin.parameters == number_of_given_args && "builtin arity mismatch");
-    switch (number_of_given_args)
+    watch_form_t *form = &forms[n++];
+    *form = (watch_form_t){.offset = st.tok - text, .previous = -1};
+    if (!watch_parse(&st, text, form))
     {
-    case 0:
-      return builtin.func0();
-    case 1:
-      return builtin.func1(eval(forms[1], env));
-    case 2:
-      return builtin.func2(eval(forms[1], env), eval(forms[2], env));
-    case 3:
-      return builtin.func3(eval(forms[1], env), eval(forms[2], env), eval(forms[3], env));
-    default:
-      printf("Error: unknown builtin function %s with arity %d\n", first_word, number_of_given_args);
-      exit(1);
+      form->len = size - form->offset;
+      st.cur = st.lim;
     }
+    form->hash = hash_source(text + form->offset, form->len);
+    arena_reset(&interp->transient_arena);
   }
-  const bool is_macro = func_macro->is_macro;
-  const int number_of_regular_params = func_macro->arity;
-  const char *rest_param = func_macro->rest_param;
-  const char **parameters = func_macro->parameters;
-  int number_of_given_params;
-  if (rest_param == NULL)
+  *n_forms = n;
+  return forms;
+}
+
+// runs the forms of st, false if one stopped with an error, guarded apart from watch_evaluate like watch_parse
+bool watch_run_forms(FileLexerState *st)
+{
+  jmp_buf on_error;
+  interp->on_error = &on_error;
+  if (setjmp(on_error) != 0)
   {
-    assert(number_of_given_args == number_of_regular_params && "func/macro call arity mismatch");
-    number_of_given_params = number_of_regular_params;
+    interp->on_error = NULL;
+    interp_unwind();
+    end_top_level_form();
+    return false;
   }
-  else
+  run_forms(st);
+  interp->on_error = NULL;
+  return true;
+}
+
+// evaluates the dirty forms in order and records what they print, look up and define, stops at the first error
+// returns the number of forms evaluated
+int watch_evaluate(watch_state_t *w, watch_form_t *forms, int n_forms, char *text)
+{
+  name_map_t lookups = {0};
+  name_map_t definitions = {0};
+  set_output(w->capture);
+  int n_evaluated = 0;
+  w->n_reached = n_forms;
+  for (int i = 0; i < n_forms; i++)
   {
-    assert(number_of_given_args >= number_of_regular_params && "func/macro call arity mismatch");
-    number_of_given_params = number_of_regular_params + 1;
+    watch_form_t *form = &forms[i];
+    if (!form->dirty)
+      continue;
+    rewind(w->capture);
+    name_map_clear(&lookups);
+    name_map_clear(&definitions);
+    interp->recorded_lookups = &lookups;
+    interp->recorded_definitions = &definitions;
+    FileLexerState st;
+    init_memory_lexer(&st, text + form->offset, form->len);
+    st.copy_words = true;
+    const bool failed = !watch_run_forms(&st);
+    interp->recorded_lookups = NULL;
+    interp->recorded_definitions = NULL;
+    flush_output();
+    fflush(w->capture);
+    const long len = ftell(w->capture);
+    watch_free_form(form);
+    form->output = malloc(len + 1);
+    memcpy(form->output, w->capture_data, len);
+    form->output_len = len;
+    form->lookups = name_map_names(&lookups);
+    form->n_lookups = lookups.len;
+    form->definitions = name_map_names(&definitions);
+    form->n_definitions = definitions.len;
+    form->complete = !failed;
+    n_evaluated++;
+    if (failed)
+    {
+      for (int j = i + 1; j < n_forms; j++)
+        forms[j].complete = false;
+      w->n_reached = i + 1;
+      break;
+    }
   }
+  name_map_free(&lookups);
+  name_map_free(&definitions);
+  return n_evaluated;
+}
+
+// whether two forms define a name, which an incremental run cannot order
+// the forms after an error count as well, their definitions stay from the previous run
+bool watch_has_duplicates(const watch_form_t *forms, int n_forms, name_map_t *defined_at)
+{
+  for (int i = 0; i < n_forms; i++)
+    for (int k = 0; k < forms[i].n_definitions; k++)
+      if (name_map_put(defined_at, forms[i].definitions[k], i) >= 0)
+        return true;
+  return false;
+}
 
-  // eval args if func
-  form_t *args = malloc(sizeof(form_t) * number_of_given_args);
-  if (is_macro)
+// starts from the image and prelude and evaluates every form
+int watch_full_run(watch_state_t *w, watch_form_t *forms, int n_forms, char *text)
+{
+  interp_reset(w->capture);
+  define_image();
+  run_prelude();
+  name_map_clear(&w->base_names);
+  for (int i = 0; i < interp->func_macro_env.cap; i++)
   {
-    for (int i = 1; i < length; i++)
-      args[i - 1] = forms[i];
+    const FuncMacroBinding *b = &interp->func_macro_env.bindings[i];
+    if (b->name != NULL && (b->func_macro != NULL || b->builtin != NULL))
+      name_map_put(&w->base_names, b->name, 0);
   }
-  else
+  for (int i = 0; i < n_forms; i++)
+    forms[i].dirty = true;
+  const int n_evaluated = watch_evaluate(w, forms, n_forms, text);
+  name_map_t defined_at = {0};
+  w->needs_full_run = watch_has_duplicates(forms, n_forms, &defined_at);
+  name_map_free(&defined_at);
+  return n_evaluated;
+}
+
+// the new forms take over the records of the previous forms with the same text, first come first served
+void watch_match(watch_state_t *w, watch_form_t *forms, int n_forms)
+{
+  int cap = 64;
+  while (cap < w->n_forms * 2)
+    cap *= 2;
+  // heads[slot] is the first previous form not taken yet with a hash, next chains the others in order
+  int *heads = malloc(sizeof(int) * cap);
+  int *next = malloc(sizeof(int) * (w->n_forms + 1));
+  memset(heads, -1, sizeof(int) * cap);
+  const int mask = cap - 1;
+  for (int j = w->n_forms - 1; j >= 0; j--)
+  {
+    int slot = w->forms[j].hash & mask;
+    while (heads[slot] >= 0 && w->forms[heads[slot]].hash != w->forms[j].hash)
+      slot = (slot + 1) & mask;
+    next[j] = heads[slot];
+    heads[slot] = j;
+  }
+  for (int i = 0; i < n_forms; i++)
   {
-    for (int i = 1; i < length; i++)
-      args[i - 1] = eval(forms[i], env);
+    int slot = forms[i].hash & mask;
+    while (heads[slot] >= 0 && w->forms[heads[slot]].hash != forms[i].hash)
+      slot = (slot + 1) & mask;
+    const int j = heads[slot];
+    if (j < 0)
+      continue;
+    heads[slot] = next[j];
+    watch_form_t *previous = &w->forms[j];
+    forms[i].previous = j;
+    forms[i].complete = previous->complete;
+    forms[i].output = previous->output;
+    forms[i].output_len = previous->output_len;
+    forms[i].lookups = previous->lookups;
+    forms[i].n_lookups = previous->n_lookups;
+    forms[i].definitions = previous->definitions;
+    forms[i].n_definitions = previous->n_definitions;
+    *previous = (watch_form_t){0};
   }
+  free(heads);
+  free(next);
+}
 
-  Binding *bindings = malloc(sizeof(Binding) * number_of_given_params);
-  const Env_t new_env = {.parent = env, .len = number_of_given_params, .bindings = bindings};
-  for (int i = 0; i < number_of_regular_params; i++)
-    bindings[i] = (Binding){.word = parameters[i], .form = args[i]};
-
-  if (rest_param != NULL)
-    bindings[number_of_regular_params] =
-        (Binding){
-            .word = rest_param,
-            .form = slice(number_of_given_args, args, number_of_regular_params, number_of_given_args)};
-  free(args);
-  const form_t *bodies = func_macro->bodies;
-  const int n_of_bodies = func_macro->n_of_bodies;
-  form_t result;
-  for (int i = 0; i < n_of_bodies; i++)
-    result = eval(bodies[i], &new_env);
-  free(bindings);
-  if (is_macro)
-    result = eval(result, env);
+// whether every reached form is evaluated after the definitions it looks up, through the definitions it calls
+// a full run would not find a definition after the form, a definition form only compiles differently for a macro after it
+bool watch_defined_in_order(const watch_state_t *w, const watch_form_t *forms, int n_forms, const name_map_t *defined_at)
+{
+  // the last form defining a name looked up by a form or the definitions it looks up
+  int *latest = malloc(sizeof(int) * (n_forms + 1));
+  for (int i = 0; i < n_forms; i++)
+  {
+    latest[i] = -1;
+    for (int k = 0; k < forms[i].n_lookups; k++)
+    {
+      const int j = name_map_get(defined_at, forms[i].lookups[k]);
+      if (j > latest[i])
+        latest[i] = j;
+    }
+  }
+  for (bool more = true; more;)
+  {
+    more = false;
+    for (int i = 0; i < n_forms; i++)
+      for (int k = 0; k < forms[i].n_lookups; k++)
+      {
+        const int j = name_map_get(defined_at, forms[i].lookups[k]);
+        if (j >= 0 && latest[j] > latest[i])
+        {
+          latest[i] = latest[j];
+          more = true;
+        }
+      }
+  }
+  bool in_order = true;
+  for (int i = 0; i < w->n_reached && in_order; i++)
+  {
+    if (forms[i].n_definitions == 0)
+    {
+      in_order = latest[i] <= i;
+      continue;
+    }
+    for (int k = 0; k < forms[i].n_lookups && in_order; k++)
+    {
+      const FuncMacro *func_macro = get_func_macro(forms[i].lookups[k]);
+      in_order = name_map_get(defined_at, forms[i].lookups[k]) <= i || (func_macro != NULL && !func_macro->is_macro);
+    }
+  }
+  free(latest);
+  return in_order;
+}
 
-  return result;
+bool watch_looked_up_any(const watch_form_t *form, const name_map_t *names)
+{
+  for (int k = 0; k < form->n_lookups; k++)
+    if (name_map_get(names, form->lookups[k]) >= 0)
+      return true;
+  return false;
+}
+
+// evaluates the forms with new text and the forms depending on changed definitions, false when a full run is needed
+// *n_evaluated is set either way as the definitions may have changed
+bool watch_incremental_run(watch_state_t *w, watch_form_t *forms, int n_forms, char *text, int *n_evaluated)
+{
+  *n_evaluated = 0;
+  watch_match(w, forms, n_forms);
+  // names whose definition is gone or may change
+  name_map_t changed = {0};
+  for (int j = 0; j < w->n_forms; j++)
+    for (int k = 0; k < w->forms[j].n_definitions; k++)
+      name_map_put(&changed, w->forms[j].definitions[k], 0);
+  for (int i = 0; i < n_forms; i++)
+  {
+    forms[i].dirty = forms[i].previous < 0 || !forms[i].complete;
+    if (forms[i].syntactic_name != NULL && forms[i].previous < 0)
+      name_map_put(&changed, forms[i].syntactic_name, 0);
+    if (forms[i].dirty)
+      for (int k = 0; k < forms[i].n_definitions; k++)
+        name_map_put(&changed, forms[i].definitions[k], 0);
+  }
+  // a form that looked up a changed name is evaluated again, which may change what it defines
+  for (bool more = true; more;)
+  {
+    more = false;
+    for (int i = 0; i < n_forms; i++)
+      if (!forms[i].dirty && watch_looked_up_any(&forms[i], &changed))
+      {
+        forms[i].dirty = true;
+        for (int k = 0; k < forms[i].n_definitions; k++)
+          name_map_put(&changed, forms[i].definitions[k], 0);
+        more = true;
+      }
+  }
+  bool incremental = true;
+  for (int i = 0; i < changed.cap && incremental; i++)
+    if (changed.names[i] != NULL && name_map_get(&w->base_names, changed.names[i]) >= 0)
+      incremental = false;
+  if (incremental)
+  {
+    // definitions are made again in the order of the forms
+    for (int i = 0; i < changed.cap; i++)
+      if (changed.names[i] != NULL)
+        remove_func_macro_binding(changed.names[i]);
+    *n_evaluated = watch_evaluate(w, forms, n_forms, text);
+    name_map_t defined_at = {0};
+    incremental = !watch_has_duplicates(forms, n_forms, &defined_at) && watch_defined_in_order(w, forms, n_forms, &defined_at);
+    for (int i = 0; i < w->n_reached && incremental; i++)
+    {
+      const watch_form_t *form = &forms[i];
+      // a form that kept its result looked up a name that is new since the previous run
+      for (int k = 0; k < form->n_lookups && incremental && !form->dirty; k++)
+      {
+        const int j = name_map_get(&defined_at, form->lookups[k]);
+        if (j >= 0 && forms[j].dirty && name_map_get(&changed, form->lookups[k]) < 0)
+          incremental = false;
+      }
+      if (form->dirty)
+        for (int k = 0; k < form->n_definitions && incremental; k++)
+          if (name_map_get(&w->base_names, form->definitions[k]) >= 0)
+            incremental = false;
+    }
+    name_map_free(&defined_at);
+  }
+  name_map_free(&changed);
+  return incremental;
+}
+
+// polls filename until the process is stopped, prints the whole output of the program after each run
+int watch(const char *filename)
+{
+  watch_state_t w = {0};
+  w.capture = open_memstream(&w.capture_data, &w.capture_len);
+  FILE *out = interp->out;
+  const struct timespec poll_interval = {.tv_nsec = WATCH_POLL_MS * 1000000L};
+  struct stat last = {0};
+  uint64_t last_hash = 0;
+  // a file written in the last second can be written again without its mtime moving, it is read until it is older
+  bool recent = false;
+  for (bool first = true;; first = false)
+  {
+    struct stat sb;
+    while (stat(filename, &sb) != 0 ||
+           (!first && !recent && sb.st_mtim.tv_sec == last.st_mtim.tv_sec && sb.st_mtim.tv_nsec == last.st_mtim.tv_nsec && sb.st_size == last.st_size))
+      nanosleep(&poll_interval, NULL);
+    last = sb;
+    recent = sb.st_mtim.tv_sec >= time(NULL) - 1;
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+      continue;
+    char *text = malloc(sb.st_size + 1);
+    const size_t size = fread(text, 1, sb.st_size, file);
+    fclose(file);
+    const uint64_t hash = hash_source(text, size);
+    if (!first && hash == last_hash)
+    {
+      free(text);
+      nanosleep(&poll_interval, NULL);
+      continue;
+    }
+    last_hash = hash;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int n_forms;
+    watch_form_t *forms = watch_scan(&w, text, size, &n_forms);
+    int n_evaluated = 0;
+    const bool full = first || w.needs_full_run || !watch_incremental_run(&w, forms, n_forms, text, &n_evaluated);
+    if (full)
+      n_evaluated = watch_full_run(&w, forms, n_forms, text);
+    const double elapsed = seconds_since(&start);
+    for (int j = 0; j < w.n_forms; j++)
+      watch_free_form(&w.forms[j]);
+    free(w.forms);
+    w.forms = forms;
+    w.n_forms = n_forms;
+    free(text);
+    set_output(out);
+    for (int i = 0; i < w.n_reached; i++)
+      output_chars(w.forms[i].output, w.forms[i].output_len);
+    flush_output();
+    fprintf(stderr, "watch: %s run evaluated %d of %d top-level forms in %.3f ms\n", full ? "full" : "incremental", n_evaluated, n_forms, elapsed * 1e3);
+  }
+}
+
+#ifndef UNS_NO_MAIN
+void usage(const char *program)
+{
+  printf("Usage: %s [options] <filename>, - reads from stdin\n", program);
+  printf("       %s --batch [options] <filename>...\n", program);
+  printf("       %s --serve=<socket> [options]\n", program);
+  printf("  --expand-ahead  expand macro calls in func/macro bodies when they are defined\n");
+  printf("  --engine=eval   evaluate the node tree, the reference engine (default)\n");
+  printf("  --engine=vm     compile funcs to bytecode for the register vm, eval runs what it cannot compile\n");
+  printf("  --no-mmap       stream the input file instead of mapping it\n");
+  printf("  --profile       print calls, inclusive and exclusive time and allocations per func and builtin to stderr\n");
+  printf("  --profile-stacks=<file>  also sample call stacks and write them in collapsed stack format for flamegraphs\n");
+  printf("  --gc-stats      print collections, pause times and heap sizes to stderr on exit\n");
+  printf("  --call-cache-stats  print hits and misses of the call site caches to stderr on exit\n");
+  printf("  --flat-concat   concat copies all its lists instead of appending to spare room of the first\n");
+  printf("  --no-optimize   run func bodies as written, without folding constants and inlining small funcs\n");
+  printf("  --max-depth=N   stop with an error when calls nest deeper than N, default %d\n", DEFAULT_MAX_DEPTH);
+  printf("  --bench         time each top-level form and print json, see --warmup=N and --repetitions=N\n");
+  printf("  --bench-parse   only parse the file and report forms/s and bytes/s, without a file parse 64 MB of synthetic input\n");
+  printf("  --bench-print   print a wide and a deep list of a million items repetitions times to /dev/null and report bytes/s\n");
+  printf("  --prelude=<file>  evaluate the forms of file first without printing their results\n");
+  printf("  --save-image=<file>  after running, write the func/macro definitions to an image file\n");
+  printf("  --image=<file>  start with the definitions of an image file, before the prelude\n");
+  printf("  --ast-cache     load the parsed forms of the file from <file>.ast, written when it is missing or the file changed\n");
+  printf("                  with --bench-parse time loading it instead of parsing\n");
+  printf("  --emit-c=<file> compile the program to c in file instead of running it, build that with -I of the directory of lexer.c\n");
+  printf("  --batch         run each file in a fresh interpreter on a pool of threads, outputs are printed in file order\n");
+  printf("  --watch         run the file and run it again when it changes, evaluating only the forms that changed or depend on changed definitions\n");
+  printf("  --jobs=N        number of --batch threads, default the number of processors\n");
+  printf("  --serve=<socket> evaluate lines of forms sent to a unix socket after loading --image and --prelude once\n");
+  printf("                  each response is the output of a line and an empty line, definitions last for their line\n");
+  exit(1);
 }
 
 int main(int argc, char **argv)
 {
-  if (argc < 2)
+  const char **filenames = malloc(sizeof(char *) * argc);
+  int n_files = 0;
+  const char *prelude_filename = NULL;
+  const char *image_filename = NULL;
+  const char *save_image_filename = NULL;
+  const char *emit_c_filename = NULL;
+  const char *serve_path = NULL;
+  bool use_mmap = true;
+  bool parse_only = false;
+  bool print_only = false;
+  bool bench = false;
+  bool profile = false;
+  bool batch_mode = false;
+  bool watch_mode = false;
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  int warmup = 3;
+  int repetitions = 10;
+  for (int i = 1; i < argc; i++)
   {
-    printf("Usage: %s <filename>\n", argv[0]);
-    exit(1);
+    if (strcmp(argv[i], "--expand-ahead") == 0)
+      expand_ahead = true;
+    else if (strcmp(argv[i], "--engine=eval") == 0)
+      engine = engine_eval;
+    else if (strcmp(argv[i], "--engine=vm") == 0)
+      engine = engine_vm;
+    else if (strcmp(argv[i], "--no-mmap") == 0)
+      use_mmap = false;
+    else if (strcmp(argv[i], "--bench-parse") == 0)
+      parse_only = true;
+    else if (strcmp(argv[i], "--bench-print") == 0)
+      print_only = true;
+    else if (strcmp(argv[i], "--profile") == 0)
+      profile = true;
+    else if (strncmp(argv[i], "--profile-stacks=", 17) == 0)
+      profile_stacks_filename = argv[i] + 17;
+    else if (strcmp(argv[i], "--gc-stats") == 0)
+      gc_stats = true;
+    else if (strcmp(argv[i], "--call-cache-stats") == 0)
+      call_cache_stats = true;
+    else if (strcmp(argv[i], "--flat-concat") == 0)
+      flat_concat = true;
+    else if (strcmp(argv[i], "--no-optimize") == 0)
+      optimize_funcs = false;
+    else if (strncmp(argv[i], "--max-depth=", 12) == 0)
+      max_depth = atoi(argv[i] + 12);
+    else if (strcmp(argv[i], "--bench") == 0)
+      bench = true;
+    else if (strncmp(argv[i], "--warmup=", 9) == 0)
+      warmup = atoi(argv[i] + 9);
+    else if (strncmp(argv[i], "--repetitions=", 14) == 0)
+      repetitions = atoi(argv[i] + 14);
+    else if (strncmp(argv[i], "--prelude=", 10) == 0)
+      prelude_filename = argv[i] + 10;
+    else if (strncmp(argv[i], "--image=", 8) == 0)
+      image_filename = argv[i] + 8;
+    else if (strncmp(argv[i], "--save-image=", 13) == 0)
+      save_image_filename = argv[i] + 13;
+    else if (strncmp(argv[i], "--emit-c=", 9) == 0)
+      emit_c_filename = argv[i] + 9;
+    else if (strcmp(argv[i], "--ast-cache") == 0)
+      ast_cache = true;
+    else if (strcmp(argv[i], "--batch") == 0)
+      batch_mode = true;
+    else if (strcmp(argv[i], "--watch") == 0)
+      watch_mode = true;
+    else if (strncmp(argv[i], "--serve=", 8) == 0)
+      serve_path = argv[i] + 8;
+    else if (strncmp(argv[i], "--jobs=", 7) == 0)
+      jobs = atoi(argv[i] + 7);
+    else if (argv[i][0] == '-' && argv[i][1] != '\0')
+      usage(argv[0]);
+    else
+      filenames[n_files++] = argv[i];
+  }
+  init_symbols();
+  // static as the atexit handlers read it after main returned
+  static interp_t main_interp;
+  interp_init(&main_interp, stdout);
+  flush_output_at_exit();
+  if (n_files == 0 && parse_only)
+  {
+    size_t size;
+    char *text = synthetic_parse_input(64 * 1024 * 1024, &size);
+    FileLexerState st;
+    init_memory_lexer(&st, text, size);
+    bench_parse(&st);
+    return 0;
+  }
+  if (n_files == 0 && print_only && repetitions >= 1)
+  {
+    bench_print(repetitions);
+    return 0;
+  }
+  if ((n_files == 0 && serve_path == NULL) || (n_files > 0 && serve_path != NULL) || (watch_mode && (batch_mode || serve_path != NULL)) || (n_files > 1 && !batch_mode) || warmup < 0 || repetitions < 1 || max_depth < 1 || jobs < 1)
+    usage(argv[0]);
+  init_native_stack((const char *)&argc);
+  if (image_filename != NULL)
+    load_image(image_filename);
+  if (prelude_filename != NULL)
+    load_prelude(prelude_filename);
+  if (batch_mode)
+  {
+    // the profiler, the gc statistics and the benchmarks only follow one interpreter
+    if (parse_only || bench || profile || profile_stacks_filename != NULL || gc_stats || call_cache_stats || save_image_filename != NULL)
+    {
+      printf("Error: --batch cannot be combined with --bench, --bench-parse, --profile, --gc-stats, --call-cache-stats or --save-image\n");
+      exit(1);
+    }
+    return run_batch(n_files, filenames, jobs);
+  }
+  if (serve_path != NULL)
+  {
+    define_image();
+    run_prelude();
+    return serve(serve_path);
+  }
+  const char *filename = filenames[0];
+  if (watch_mode)
+  {
+    // every run starts from the image and prelude, the forms of the file are evaluated and printed one at a time
+    if (strcmp(filename, "-") == 0 || parse_only || bench || profile || profile_stacks_filename != NULL || ast_cache || emit_c_filename != NULL || save_image_filename != NULL)
+    {
+      printf("Error: --watch needs a file and cannot be combined with --bench, --bench-parse, --profile, --ast-cache, --emit-c or --save-image\n");
+      exit(1);
+    }
+    return watch(filename);
   }
-  FILE *file = fopen(argv[1], "r");
+  const bool from_stdin = strcmp(filename, "-") == 0;
+  FILE *file = from_stdin ? stdin : fopen(filename, "r");
   if (file == NULL)
   {
     printf("Error: could not open file\n");
     exit(1);
   }
-  FileLexerState st = init_lexer(file);
-
-  int c;
-  while ((c = peek_char(&st)) >= 0)
+  if (gc_stats)
+    atexit(print_gc_stats);
+  if (call_cache_stats)
+    atexit(print_call_cache_stats);
+  if (profile || profile_stacks_filename != NULL)
   {
-    if (classify_char(c) == WHITESPACE)
+    profile_start(profile_stacks_filename != NULL);
+    atexit(profile_finish);
+  }
+  FileLexerState st;
+  if (!use_mmap || !init_mapped_lexer(&st, file))
+    init_lexer(&st, file);
+  if (ast_cache && !st.mapped)
+  {
+    printf("Error: --ast-cache needs a regular file\n");
+    exit(1);
+  }
+  if (parse_only)
+  {
+    if (!st.mapped)
     {
-      next_char(&st);
-      continue;
+      printf("Error: --bench-parse needs a regular file\n");
+      exit(1);
+    }
+    if (ast_cache)
+      bench_ast_cache(&st, filename);
+    else
+      bench_parse(&st);
+    fclose(file);
+    return 0;
+  }
+  if (emit_c_filename != NULL)
+  {
+    // the compiled program starts with nothing but the builtins
+    if (image_filename != NULL || prelude_filename != NULL)
+    {
+      printf("Error: --emit-c cannot be combined with --image or --prelude\n");
+      exit(1);
+    }
+    emit_c(&st, filename, emit_c_filename);
+    return 0;
+  }
+  define_image();
+  run_prelude();
+  if (bench)
+  {
+    // the json quotes form sources straight from the mapped file
+    if (!st.mapped)
+    {
+      printf("Error: --bench needs a regular file\n");
+      exit(1);
     }
-    form_t form = parse(&st);
-    form_t evaluated = eval(form, NULL);
-    print_form(evaluated);
-    printf("\n");
+    bench_forms(&st, warmup, repetitions);
+    fclose(file);
+    return 0;
   }
+  if (ast_cache)
+    run_cached_forms(&st, filename, true);
+  else
+    run_forms(&st);
+  if (save_image_filename != NULL)
+    save_image(save_image_filename);
 
-  fclose(file);
+  if (!from_stdin)
+    fclose(file);
 }
+#endif
@@ -0,0 +1,97 @@
+// times each top-level form of a uns file on the js engine and optionally on the c interpreter
+// usage: node js/bench.js <file> [--warmup=N] [--repetitions=N] [--c=path/to/uns] [--engine=eval|vm] [--json]
+import fs from 'node:fs'
+import { execFileSync } from 'node:child_process'
+import { makeLexBox, skipWhitespaceComments, parse } from './read.js'
+import { makeEvaluator } from './main.js'
+
+const args = process.argv.slice(2)
+const option = (name, defaultValue) => {
+  const arg = args.find((a) => a.startsWith(`--${name}=`))
+  return arg ? arg.slice(name.length + 3) : defaultValue
+}
+const filename = args.find((a) => !a.startsWith('--'))
+if (!filename) {
+  console.log(
+    'usage: node js/bench.js <file> [--warmup=N] [--repetitions=N] [--c=path/to/uns] [--engine=eval|vm] [--json]',
+  )
+  process.exit(1)
+}
+const warmup = Number(option('warmup', '3'))
+const repetitions = Number(option('repetitions', '10'))
+const cBinary = option('c', null)
+const cEngine = option('engine', 'eval')
+const asJson = args.includes('--json')
+
+const isDefinition = (form) =>
+  Array.isArray(form) && form.length > 0 && ['func', 'macro'].includes(form[0].text)
+
+// same shape as the json from the c interpreters --bench mode, without allocation counts
+const benchJs = (content) => {
+  const evaluate = makeEvaluator()
+  const lexBox = makeLexBox(content)
+  const readForm = parse(lexBox)
+  const forms = []
+  while (true) {
+    skipWhitespaceComments(lexBox)
+    const start = lexBox.currentToken()
+    if (start === null) break
+    const form = readForm()
+    const end = lexBox.currentToken()
+    const source = content
+      .slice(start.startIndex, end === null ? content.length : end.startIndex)
+      .trim()
+      .replaceAll('\n', ' ')
+    const definition = isDefinition(form)
+    const runs = definition ? 1 : repetitions
+    if (!definition) for (let i = 0; i < warmup; i++) evaluate(form)
+    const times = []
+    for (let i = 0; i < runs; i++) {
+      const before = process.hrtime.bigint()
+      evaluate(form)
+      times.push(Number(process.hrtime.bigint() - before))
+    }
+    const mean = times.reduce((a, b) => a + b, 0) / runs
+    times.sort((a, b) => a - b)
+    forms.push({
+      index: forms.length,
+      source: source.length > 80 ? source.slice(0, 80) + '...' : source,
+      definition,
+      runs,
+      min_ns: times[0],
+      median_ns: times[Math.floor(runs / 2)],
+      mean_ns: Math.round(mean),
+      max_ns: times[runs - 1],
+    })
+  }
+  return { engine: 'js', warmup, repetitions, forms }
+}
+
+const benchC = () => {
+  const output = execFileSync(cBinary, [
+    '--bench',
+    `--engine=${cEngine}`,
+    `--warmup=${warmup}`,
+    `--repetitions=${repetitions}`,
+    filename,
+  ])
+  return JSON.parse(output)
+}
+
+const js = benchJs(fs.readFileSync(filename, 'utf8'))
+const c = cBinary ? benchC() : null
+
+if (asJson) {
+  console.log(JSON.stringify(c ? { js, c } : js, null, 2))
+} else {
+  const ms = (ns) => (ns / 1e6).toFixed(3).padStart(10)
+  console.log(`${'js ms'.padStart(10)} ${c ? `${`c ${cEngine} ms`.padStart(10)}      x ` : ''}form`)
+  for (const form of js.forms) {
+    if (form.definition) continue
+    const cForm = c && c.forms[form.index]
+    const columns = [ms(form.median_ns)]
+    if (cForm)
+      columns.push(ms(cForm.median_ns), (form.median_ns / cForm.median_ns).toFixed(1).padStart(6))
+    console.log(`${columns.join(' ')} ${form.source}`)
+  }
+}